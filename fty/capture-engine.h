@@ -0,0 +1,567 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+#pragma once
+#include <fty/process.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <vector>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define FTY_HAS_IO_URING 1
+#endif
+
+namespace fty {
+
+// =========================================================================================================================================
+
+#ifdef FTY_HAS_IO_URING
+
+namespace details {
+
+    /// Minimal io_uring ring over raw system calls
+    class IoUring
+    {
+    public:
+        IoUring() = default;
+        ~IoUring();
+
+        IoUring(const IoUring&) = delete;
+        IoUring& operator=(const IoUring&) = delete;
+
+        /// Creates the ring
+        Expected<void> init(unsigned entries);
+
+        /// Unmaps and closes the ring
+        void reset();
+
+        /// Returns if the ring was created
+        bool isValid() const;
+
+        /// Returns next free submission entry, submits pending ones if the queue is full
+        io_uring_sqe* sqe();
+
+        /// Submits pending entries and waits for at least `wait` completions. Returns without waiting if the
+        /// completion queue is full, the completions must be popped then.
+        Expected<void> submit(unsigned wait);
+
+        /// Pops next completion, returns false if there is none
+        bool cqe(io_uring_cqe& cqe);
+
+        /// Registers fixed buffers
+        bool registerBuffers(const std::vector<iovec>& buffers);
+
+        /// Unregisters fixed buffers
+        void unregisterBuffers();
+
+    private:
+        int           m_fd         = -1;
+        void*         m_sqRing     = nullptr;
+        size_t        m_sqRingSize = 0;
+        void*         m_cqRing     = nullptr;
+        size_t        m_cqRingSize = 0;
+        io_uring_sqe* m_sqes       = nullptr;
+        size_t        m_sqesSize   = 0;
+        unsigned      m_entries    = 0;
+        unsigned      m_tail       = 0;
+        unsigned      m_submitted  = 0;
+        unsigned*     m_sqHead     = nullptr;
+        unsigned*     m_sqTail     = nullptr;
+        unsigned*     m_sqMask     = nullptr;
+        unsigned*     m_sqArray    = nullptr;
+        unsigned*     m_cqHead     = nullptr;
+        unsigned*     m_cqTail     = nullptr;
+        unsigned*     m_cqMask     = nullptr;
+        io_uring_cqe* m_cqes       = nullptr;
+    };
+
+} // namespace details
+
+#endif
+
+// =========================================================================================================================================
+
+/// Reads many pipes until end of file at once, for example captured outputs of many children.
+/// Uses io_uring when the kernel allows it: reads of all the pipes are batched into one submission and go to
+/// registered buffers, so there is one system call per batch instead of poll + read per chunk. Falls back
+/// to epoll otherwise.
+class CaptureEngine
+{
+public:
+    enum class Backend
+    {
+        Auto,
+        IoUring,
+        Epoll
+    };
+
+public:
+    /// @param backend preferred backend, io_uring falls back to epoll if it is not available
+    /// @param bufferSize read buffer size per pipe
+    CaptureEngine(Backend backend = Backend::Auto, size_t bufferSize = 65536);
+
+    CaptureEngine(const CaptureEngine&) = delete;
+    CaptureEngine& operator=(const CaptureEngine&) = delete;
+
+    /// Returns backend in use
+    Backend backend() const;
+
+    /// Adds a pipe, its data is appended to the output until end of file
+    void add(int fd, std::string& output);
+
+    /// Adds captured standard output and error of the running process
+    void add(Process& process, std::string& out, std::string& err);
+
+    /// Reads all the added pipes until end of file. Pipes are forgotten afterwards.
+    /// @param milliseconds overall timeout, -1 to wait forever
+    Expected<void> run(int milliseconds = -1);
+
+private:
+    struct Stream
+    {
+        int          fd;
+        std::string* output;
+        bool         done = false;
+    };
+
+    Expected<void> runEpoll(int milliseconds);
+#ifdef FTY_HAS_IO_URING
+    Expected<void> runIoUring(int milliseconds);
+#endif
+
+private:
+    Backend             m_backend;
+    size_t              m_bufferSize;
+    std::vector<Stream> m_streams;
+#ifdef FTY_HAS_IO_URING
+    details::IoUring m_ring;
+#endif
+};
+
+// =========================================================================================================================================
+
+#ifdef FTY_HAS_IO_URING
+
+namespace details {
+
+    inline IoUring::~IoUring()
+    {
+        reset();
+    }
+
+    inline void IoUring::reset()
+    {
+        if (m_sqes) {
+            munmap(m_sqes, m_sqesSize);
+        }
+        if (m_cqRing && m_cqRing != m_sqRing) {
+            munmap(m_cqRing, m_cqRingSize);
+        }
+        if (m_sqRing) {
+            munmap(m_sqRing, m_sqRingSize);
+        }
+        if (m_fd != -1) {
+            close(m_fd);
+        }
+        m_sqes   = nullptr;
+        m_cqRing = nullptr;
+        m_sqRing = nullptr;
+        m_fd     = -1;
+    }
+
+    inline Expected<void> IoUring::init(unsigned entries)
+    {
+        io_uring_params params = {};
+
+        m_fd = int(syscall(__NR_io_uring_setup, entries, &params));
+        if (m_fd == -1) {
+            return unexpected("io_uring_setup failed: {}", strerror(errno));
+        }
+
+        m_entries    = params.sq_entries;
+        m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        m_sqesSize   = params.sq_entries * sizeof(io_uring_sqe);
+
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) {
+            m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+        }
+
+        auto mapRing = [&](size_t size, off_t offset) -> void* {
+            void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+            return addr == MAP_FAILED ? nullptr : addr;
+        };
+
+        m_sqRing = mapRing(m_sqRingSize, IORING_OFF_SQ_RING);
+        m_cqRing = single ? m_sqRing : mapRing(m_cqRingSize, IORING_OFF_CQ_RING);
+        m_sqes   = static_cast<io_uring_sqe*>(mapRing(m_sqesSize, IORING_OFF_SQES));
+        if (!m_sqRing || !m_cqRing || !m_sqes) {
+            return unexpected("io_uring mmap failed: {}", strerror(errno));
+        }
+
+        auto sq   = static_cast<char*>(m_sqRing);
+        auto cq   = static_cast<char*>(m_cqRing);
+        m_sqHead  = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        m_sqTail  = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        m_sqMask  = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        m_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        m_cqHead  = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        m_cqTail  = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        m_cqMask  = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        m_cqes    = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        m_tail = m_submitted = *m_sqTail;
+        return {};
+    }
+
+    inline bool IoUring::isValid() const
+    {
+        return m_sqes != nullptr;
+    }
+
+    inline io_uring_sqe* IoUring::sqe()
+    {
+        if (m_tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_entries) {
+            if (!submit(0)) {
+                return nullptr;
+            }
+            if (m_tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_entries) {
+                return nullptr;
+            }
+        }
+
+        unsigned index = m_tail & *m_sqMask;
+        auto*    entry = &m_sqes[index];
+        memset(entry, 0, sizeof(*entry));
+        m_sqArray[index] = index;
+        ++m_tail;
+        return entry;
+    }
+
+    inline Expected<void> IoUring::submit(unsigned wait)
+    {
+        __atomic_store_n(m_sqTail, m_tail, __ATOMIC_RELEASE);
+
+        unsigned count = m_tail - m_submitted;
+        while (true) {
+            auto ret = syscall(__NR_io_uring_enter, m_fd, count, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (ret >= 0) {
+                m_submitted += unsigned(ret);
+                return {};
+            }
+            if (errno == EBUSY) {
+                // Completion queue overflowed, caller pops completions and comes back
+                return {};
+            }
+            if (errno != EINTR) {
+                return unexpected("io_uring_enter failed: {}", strerror(errno));
+            }
+        }
+    }
+
+    inline bool IoUring::cqe(io_uring_cqe& cqe)
+    {
+        unsigned head = *m_cqHead;
+        if (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+        cqe = m_cqes[head & *m_cqMask];
+        __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    inline bool IoUring::registerBuffers(const std::vector<iovec>& buffers)
+    {
+        return syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS, buffers.data(), buffers.size()) == 0;
+    }
+
+    inline void IoUring::unregisterBuffers()
+    {
+        syscall(__NR_io_uring_register, m_fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+    }
+
+} // namespace details
+
+#endif
+
+// =========================================================================================================================================
+
+inline CaptureEngine::CaptureEngine(Backend backend, size_t bufferSize)
+    : m_backend(Backend::Epoll)
+    , m_bufferSize(bufferSize)
+{
+#ifdef FTY_HAS_IO_URING
+    // Disabled by seccomp or sysctl in many containers, epoll then
+    if (backend != Backend::Epoll && m_ring.init(256)) {
+        m_backend = Backend::IoUring;
+    }
+#else
+    (void)backend;
+#endif
+}
+
+inline CaptureEngine::Backend CaptureEngine::backend() const
+{
+    return m_backend;
+}
+
+inline void CaptureEngine::add(int fd, std::string& output)
+{
+    m_streams.push_back({fd, &output});
+}
+
+inline void CaptureEngine::add(Process& process, std::string& out, std::string& err)
+{
+    if (process.m_stdout) {
+        add(process.m_stdout, out);
+    }
+    if (process.m_stderr) {
+        add(process.m_stderr, err);
+    }
+}
+
+inline Expected<void> CaptureEngine::run(int milliseconds)
+{
+#ifdef FTY_HAS_IO_URING
+    auto ret = m_backend == Backend::IoUring ? runIoUring(milliseconds) : runEpoll(milliseconds);
+#else
+    auto ret = runEpoll(milliseconds);
+#endif
+    m_streams.clear();
+    if (!ret) {
+        return unexpected(ret.error());
+    }
+    return {};
+}
+
+inline Expected<void> CaptureEngine::runEpoll(int milliseconds)
+{
+    int epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll == -1) {
+        return unexpected("epoll_create failed: {}", strerror(errno));
+    }
+
+    size_t active = 0;
+    for (size_t i = 0; i < m_streams.size(); ++i) {
+        epoll_event ev = {};
+        ev.events      = EPOLLIN;
+        ev.data.u64    = i;
+        if (epoll_ctl(epoll, EPOLL_CTL_ADD, m_streams[i].fd, &ev) == -1) {
+            close(epoll);
+            return unexpected("epoll_ctl failed: {}", strerror(errno));
+        }
+        ++active;
+    }
+
+    auto                     deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+    std::string              buffer(m_bufferSize, '\0');
+    std::vector<epoll_event> events(std::max(m_streams.size(), size_t(1)));
+
+    while (active) {
+        int timeout = -1;
+        if (milliseconds >= 0) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            timeout   = std::max(0, int(left.count()));
+        }
+
+        int count = epoll_wait(epoll, events.data(), int(events.size()), timeout);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        } else if (count == -1) {
+            close(epoll);
+            return unexpected("epoll_wait failed: {}", strerror(errno));
+        } else if (count == 0) {
+            close(epoll);
+            return unexpected("timeout");
+        }
+
+        for (int i = 0; i < count; ++i) {
+            auto& stream    = m_streams[events[size_t(i)].data.u64];
+            auto  bytesRead = read(stream.fd, buffer.data(), buffer.size());
+            if (bytesRead > 0) {
+                stream.output->append(buffer.data(), size_t(bytesRead));
+            } else if (bytesRead == -1 && errno != EINTR && errno != EAGAIN) {
+                close(epoll);
+                return unexpected("read failed: {}", strerror(errno));
+            } else if (bytesRead == 0) {
+                epoll_ctl(epoll, EPOLL_CTL_DEL, stream.fd, nullptr);
+                stream.done = true;
+                --active;
+            }
+        }
+    }
+
+    close(epoll);
+    return {};
+}
+
+#ifdef FTY_HAS_IO_URING
+
+inline Expected<void> CaptureEngine::runIoUring(int milliseconds)
+{
+    static constexpr uint64_t timeoutTag = ~uint64_t(0);
+    static constexpr uint64_t cancelTag  = ~uint64_t(0) - 1;
+
+    // One buffer per pipe, registered so the kernel does not map them on every read
+    std::unique_ptr<char[]> memory(new char[m_streams.size() * m_bufferSize]);
+    std::vector<iovec>      buffers(m_streams.size());
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        buffers[i] = {memory.get() + i * m_bufferSize, m_bufferSize};
+    }
+    bool fixed = !buffers.empty() && m_ring.registerBuffers(buffers);
+
+    // Stream which is not done has exactly one read in flight
+    size_t      inflight = 0;
+    size_t      active   = m_streams.size();
+    bool        timerSet = false;
+    bool        broken   = false;
+    std::string error;
+
+    auto sqe = [&]() -> io_uring_sqe* {
+        auto* entry = broken ? nullptr : m_ring.sqe();
+        if (!entry) {
+            broken = true;
+        }
+        return entry;
+    };
+
+    auto queueRead = [&](size_t index) {
+        auto* entry = sqe();
+        if (!entry) {
+            return false;
+        }
+        entry->opcode    = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        entry->fd        = m_streams[index].fd;
+        entry->addr      = reinterpret_cast<uint64_t>(buffers[index].iov_base);
+        entry->len       = unsigned(m_bufferSize);
+        entry->off       = ~uint64_t(0);
+        entry->buf_index = uint16_t(index);
+        entry->user_data = index;
+        ++inflight;
+        return true;
+    };
+
+    auto queueCancel = [&](uint8_t opcode, uint64_t target) {
+        if (auto* entry = sqe()) {
+            entry->opcode    = opcode;
+            entry->fd        = -1;
+            entry->addr      = target;
+            entry->user_data = cancelTag;
+            ++inflight;
+        }
+    };
+
+    // First error wins, reads still in flight are cancelled and drained
+    auto stop = [&](const std::string& reason) {
+        if (!error.empty()) {
+            return;
+        }
+        error = reason;
+        for (size_t i = 0; i < m_streams.size(); ++i) {
+            if (!m_streams[i].done) {
+                queueCancel(IORING_OP_ASYNC_CANCEL, i);
+            }
+        }
+    };
+
+    for (size_t i = 0; i < m_streams.size() && !broken; ++i) {
+        queueRead(i);
+    }
+
+    // Copied by the kernel on submission
+    __kernel_timespec timeout = {milliseconds / 1000, (milliseconds % 1000) * 1000000LL};
+    if (milliseconds >= 0 && active) {
+        if (auto* entry = sqe()) {
+            entry->opcode    = IORING_OP_TIMEOUT;
+            entry->fd        = -1;
+            entry->addr      = reinterpret_cast<uint64_t>(&timeout);
+            entry->len       = 1;
+            entry->user_data = timeoutTag;
+            ++inflight;
+            timerSet = true;
+        }
+    }
+
+    while (inflight && !broken) {
+        if (auto ret = m_ring.submit(1); !ret) {
+            stop(ret.error());
+            broken = true;
+            break;
+        }
+
+        io_uring_cqe cqe;
+        while (m_ring.cqe(cqe)) {
+            --inflight;
+
+            if (cqe.user_data == cancelTag) {
+                continue;
+            }
+
+            if (cqe.user_data == timeoutTag) {
+                timerSet = false;
+                if (cqe.res == -ETIME && active) {
+                    stop("timeout");
+                }
+                continue;
+            }
+
+            auto& stream = m_streams[cqe.user_data];
+            if (cqe.res > 0) {
+                stream.output->append(static_cast<char*>(buffers[cqe.user_data].iov_base), size_t(cqe.res));
+            }
+
+            bool again = cqe.res > 0 || cqe.res == -EINTR || cqe.res == -EAGAIN;
+            if (again && error.empty() && queueRead(cqe.user_data)) {
+                continue;
+            }
+            stream.done = true;
+            --active;
+
+            if (!again && cqe.res < 0 && cqe.res != -ECANCELED) {
+                stop(fmt::format("read failed: {}", strerror(-cqe.res)));
+            }
+            if (!active && timerSet) {
+                queueCancel(IORING_OP_TIMEOUT_REMOVE, timeoutTag);
+                timerSet = false;
+            }
+        }
+    }
+
+    if (broken) {
+        // Requests of a ring which can not be entered anymore can not be waited for. The kernel may still
+        // write to the buffers while it tears the ring down, so they are leaked on purpose, and next runs use
+        // epoll.
+        (void)memory.release();
+        m_ring.reset();
+        m_backend = Backend::Epoll;
+        return unexpected(error.empty() ? "io_uring submission queue is full" : error);
+    }
+
+    if (fixed) {
+        m_ring.unregisterBuffers();
+    }
+    if (!error.empty()) {
+        return unexpected(error);
+    }
+    return {};
+}
+
+#endif
+
+// =========================================================================================================================================
+
+} // namespace fty
@@ -0,0 +1,254 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <fty/process.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace fty {
+
+// =========================================================================================================================================
+
+/// Pool of long living helper processes, serving requests over their standard input and output.
+/// Request is written to the helper as is, response is everything the helper prints up to the terminator.
+/// Dead helpers are restarted before the request is sent, helpers which fail or time out in the middle of
+/// the request are killed and restarted on the next use.
+class CoprocessPool
+{
+public:
+    /// @param cmd helper command
+    /// @param args helper arguments
+    /// @param size number of helpers to keep alive
+    /// @param terminator end of response marker, not included in the response
+    CoprocessPool(const std::string& cmd, const Process::Arguments& args = {}, size_t size = 1, const std::string& terminator = "\n");
+    ~CoprocessPool() = default;
+
+    CoprocessPool(const CoprocessPool&) = delete;
+    CoprocessPool& operator=(const CoprocessPool&) = delete;
+
+    /// Sends request to a free helper and reads its response, blocks if all the helpers are busy
+    /// @param request request, sent as is
+    /// @param milliseconds response timeout, -1 to wait forever
+    Expected<std::string> call(const std::string& request, int milliseconds = -1);
+
+    /// Restarts idle helpers which are not running anymore
+    /// @return number of restarted helpers
+    size_t checkHealth();
+
+    /// Returns number of helpers
+    size_t size() const;
+
+    /// Returns number of helper restarts (not counting the first start)
+    size_t restarts() const;
+
+private:
+    struct Helper
+    {
+        std::unique_ptr<Process> process;
+        std::string              pending;
+        bool                     busy    = false;
+        bool                     started = false;
+    };
+
+    Helper*        acquire();
+    void           release(Helper* helper, bool healthy);
+    Expected<void> ensureRunning(Helper& helper);
+    bool           isAlive(Helper& helper);
+
+private:
+    std::string             m_cmd;
+    Process::Arguments      m_args;
+    std::string             m_terminator;
+    std::vector<Helper>     m_helpers;
+    std::mutex              m_mutex;
+    std::condition_variable m_cv;
+    std::atomic<size_t>     m_restarts = 0;
+};
+
+// =========================================================================================================================================
+
+inline CoprocessPool::CoprocessPool(const std::string& cmd, const Process::Arguments& args, size_t size, const std::string& terminator)
+    : m_cmd(cmd)
+    , m_args(args)
+    , m_terminator(terminator)
+    , m_helpers(size ? size : 1)
+{
+}
+
+inline Expected<std::string> CoprocessPool::call(const std::string& request, int milliseconds)
+{
+    Helper* helper = acquire();
+
+    if (auto ret = ensureRunning(*helper); !ret) {
+        release(helper, false);
+        return unexpected(ret.error());
+    }
+
+    // Helper which does not read its input must not block the call either
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+    if (auto ret = details::writeAll(helper->process->m_stdin, request, deadline, milliseconds); !ret) {
+        release(helper, false);
+        return unexpected(ret.error());
+    }
+
+    size_t searched = 0;
+    while (true) {
+        if (auto pos = helper->pending.find(m_terminator, searched); pos != std::string::npos) {
+            std::string response = helper->pending.substr(0, pos);
+            helper->pending.erase(0, pos + m_terminator.size());
+            release(helper, true);
+            return response;
+        }
+        searched = helper->pending.size() >= m_terminator.size() ? helper->pending.size() - m_terminator.size() + 1 : 0;
+
+        if (auto ret = details::waitReadable(helper->process->m_stdout, deadline, milliseconds); !ret) {
+            // Helper state is unknown now, it will be restarted
+            release(helper, false);
+            return unexpected(ret.error());
+        }
+
+        std::array<char, 4096> buffer;
+        auto                   bytesRead = read(helper->process->m_stdout, buffer.data(), buffer.size());
+        if (bytesRead > 0) {
+            helper->pending.append(buffer.data(), size_t(bytesRead));
+        } else if (bytesRead == 0) {
+            release(helper, false);
+            return unexpected("helper exited");
+        } else if (errno != EINTR && errno != EAGAIN) {
+            release(helper, false);
+            return unexpected("read failed: {}", strerror(errno));
+        }
+    }
+}
+
+inline size_t CoprocessPool::checkHealth()
+{
+    // Dead helpers are taken out of the pool, restarted without the lock, and given back
+    std::vector<Helper*> dead;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& helper : m_helpers) {
+            if (!helper.busy && helper.started && !isAlive(helper)) {
+                helper.busy = true;
+                dead.push_back(&helper);
+            }
+        }
+    }
+
+    size_t restarted = 0;
+    for (auto helper : dead) {
+        if (ensureRunning(*helper)) {
+            ++restarted;
+        }
+    }
+
+    if (!dead.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto helper : dead) {
+                helper->busy = false;
+            }
+        }
+        m_cv.notify_all();
+    }
+    return restarted;
+}
+
+inline size_t CoprocessPool::size() const
+{
+    return m_helpers.size();
+}
+
+inline size_t CoprocessPool::restarts() const
+{
+    return m_restarts;
+}
+
+inline CoprocessPool::Helper* CoprocessPool::acquire()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    Helper* found = nullptr;
+    m_cv.wait(lock, [&]() {
+        for (auto& helper : m_helpers) {
+            if (!helper.busy) {
+                found = &helper;
+                return true;
+            }
+        }
+        return false;
+    });
+
+    found->busy = true;
+    return found;
+}
+
+inline void CoprocessPool::release(Helper* helper, bool healthy)
+{
+    // Destroyed after unlocking, killing and reaping the helper blocks
+    std::unique_ptr<Process> unhealthy;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!healthy) {
+            unhealthy = std::move(helper->process);
+            helper->pending.clear();
+        }
+        helper->busy = false;
+    }
+    m_cv.notify_one();
+}
+
+inline Expected<void> CoprocessPool::ensureRunning(Helper& helper)
+{
+    if (helper.process && isAlive(helper)) {
+        return {};
+    }
+
+    if (helper.started) {
+        ++m_restarts;
+    }
+
+    helper.pending.clear();
+    helper.process = std::make_unique<Process>(m_cmd, m_args, Capture::In | Capture::Out);
+    if (auto ret = helper.process->run(); !ret) {
+        helper.process.reset();
+        return unexpected(ret.error());
+    }
+    helper.started = true;
+    return {};
+}
+
+inline bool CoprocessPool::isAlive(Helper& helper)
+{
+    if (!helper.process || !helper.process->m_pid) {
+        return false;
+    }
+
+    int status = 0;
+    if (waitpid(helper.process->m_pid, &status, WNOHANG) == helper.process->m_pid) {
+        // Reaped here, process must not try to kill it
+        helper.process->m_pid = 0;
+        return false;
+    }
+    return true;
+}
+
+// =========================================================================================================================================
+
+} // namespace fty
@@ -14,11 +14,15 @@
     ========================================================================
 */
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <functional>
 #include <iostream>
 #include <memory>
 #include <mutex>
+#include <set>
 #include <vector>
 #include <fty/expected.h>
 
@@ -29,6 +33,96 @@ namespace fty {
 template <typename...>
 class Event;
 
+template <typename...>
+class IpcEvent;
+
+// ===========================================================================================================
+
+/// Event statistics, collected only if compiled with FTY_EVENT_PROFILING
+struct EventStatistics
+{
+    std::string              name;
+    uint64_t                 emitCount     = 0;
+    size_t                   listenerCount = 0;
+    std::chrono::nanoseconds slotsTime     = {}; //! Total time spent in slots
+    std::chrono::nanoseconds maxSlotTime   = {}; //! Longest single slot call
+    std::chrono::nanoseconds lockWaitTime  = {}; //! Total time spent waiting for the event mutex on emit
+};
+
+/// Returns statistics of all the living events, empty if compiled without FTY_EVENT_PROFILING
+std::vector<EventStatistics> eventStatistics();
+
+// ===========================================================================================================
+
+namespace details {
+
+#ifdef FTY_EVENT_PROFILING
+    class EventProfiler
+    {
+    public:
+        using Stamp = std::chrono::steady_clock::time_point;
+
+        EventProfiler(const std::string& name = {});
+        EventProfiler(const EventProfiler& other);
+        ~EventProfiler();
+
+        static Stamp now();
+
+        void lockAcquired(Stamp start) const;
+        void slotCalled(Stamp start) const;
+        void emitted(size_t listeners) const;
+
+        EventStatistics statistics() const;
+
+        static std::mutex&               registryMutex();
+        static std::set<EventProfiler*>& registry();
+
+    private:
+        std::string                   m_name;
+        mutable std::atomic<uint64_t> m_emitCount     = 0;
+        mutable std::atomic<size_t>   m_listenerCount = 0;
+        mutable std::atomic<int64_t>  m_slotsTime     = 0;
+        mutable std::atomic<int64_t>  m_maxSlotTime   = 0;
+        mutable std::atomic<int64_t>  m_lockWaitTime  = 0;
+    };
+#else
+    /// Does nothing, compiled out completely
+    class EventProfiler
+    {
+    public:
+        struct Stamp
+        {
+        };
+
+        EventProfiler() = default;
+        EventProfiler(const std::string&)
+        {
+        }
+
+        static Stamp now()
+        {
+            return {};
+        }
+
+        void lockAcquired(Stamp) const
+        {
+        }
+        void slotCalled(Stamp) const
+        {
+        }
+        void emitted(size_t) const
+        {
+        }
+
+        EventStatistics statistics() const
+        {
+            return {};
+        }
+    };
+#endif
+
+} // namespace details
+
 // ===========================================================================================================
 
 template <typename... Args>
@@ -59,28 +153,41 @@ public:
     Slot(const Slot&) = default;
     ~Slot();
 
-    void connect(Event<Args...>& signal);
+    /// Connects slot to the event
+    /// @param signal event to connect to
+    /// @param priority slots with higher priority are called first
+    /// @param singleShot disconnect slot after the first call
+    void connect(Event<Args...>& signal, int priority = 0, bool singleShot = false);
 
 private:
     friend class Event<Args...>;
+    friend class IpcEvent<Args...>;
     std::shared_ptr<Impl> m_impl;
 };
 
 // ===========================================================================================================
 
+/// Profiler is a base class, so it takes no space when profiling is compiled out
 template <typename... Args>
-class Event
+class Event : private details::EventProfiler
 {
 public:
     ~Event();
 
     Event() = default;
 
+    /// Creates named event, name identifies the event in statistics
+    explicit Event(const std::string& name)
+        : details::EventProfiler(name)
+    {
+    }
+
     Event(const Event&) = delete;
     Event& operator=(const Event&) = delete;
 
     Event(Event&& other)
-        : m_connections(std::move(other.m_connections))
+        : details::EventProfiler(other)
+        , m_connections(std::move(other.m_connections))
     {
     }
 
@@ -91,7 +198,12 @@ public:
 
     void operator()(Args&&... args) const;
 
-    void connect(Slot<Args...>& slot);
+    /// Connects slot to the event
+    /// @param slot slot to connect
+    /// @param priority slots with higher priority are called first, slots with the same priority are called
+    /// in connection order
+    /// @param singleShot disconnect slot after the first call
+    void connect(Slot<Args...>& slot, int priority = 0, bool singleShot = false);
 
     void wait();
 
@@ -100,8 +212,24 @@ public:
     template <typename Rep, typename Period>
     Expected<void> wait(const std::chrono::duration<Rep, Period>& timeout);
 
+    /// Returns event statistics, empty if compiled without FTY_EVENT_PROFILING
+    EventStatistics statistics() const;
+
 private:
-    using Connections = std::vector<std::weak_ptr<typename Slot<Args...>::Impl>>;
+    struct Connection
+    {
+        std::weak_ptr<typename Slot<Args...>::Impl> slot;
+        int                                         priority   = 0;
+        bool                                        singleShot = false;
+    };
+
+    // Kept sorted by priority on connect, so emit never sorts
+    using Connections = std::vector<Connection>;
+
+    const details::EventProfiler& profiler() const
+    {
+        return *this;
+    }
 
     mutable Connections             m_connections;
     mutable std::mutex              m_mutex;
@@ -126,27 +254,38 @@ template <typename... Args>
 void Event<Args...>::operator()(Args&&... args) const
 {
     {
+        auto                        lockStart = details::EventProfiler::now();
         std::lock_guard<std::mutex> lock(m_mutex);
-        Connections                 toRemove;
+        profiler().lockAcquired(lockStart);
 
         for (auto iter = m_connections.begin(); iter != m_connections.end();) {
-            if (auto caller = iter->lock()) {
+            if (auto caller = iter->slot.lock()) {
+                auto callStart = details::EventProfiler::now();
                 caller->call(std::forward<Args>(args)...);
-                ++iter;
+                profiler().slotCalled(callStart);
+                if (iter->singleShot) {
+                    iter = m_connections.erase(iter);
+                } else {
+                    ++iter;
+                }
             } else {
-                m_connections.erase(iter);
+                iter = m_connections.erase(iter);
             }
         }
+        profiler().emitted(m_connections.size());
         m_fired = true;
     }
     m_cv.notify_all();
 }
 
 template <typename... Args>
-void Event<Args...>::connect(Slot<Args...>& slot)
+void Event<Args...>::connect(Slot<Args...>& slot, int priority, bool singleShot)
 {
     std::lock_guard<std::mutex> lock(m_mutex);
-    m_connections.emplace_back(slot.m_impl);
+    auto pos = std::upper_bound(m_connections.begin(), m_connections.end(), priority, [](int prio, const Connection& conn) {
+        return prio > conn.priority;
+    });
+    m_connections.insert(pos, Connection{slot.m_impl, priority, singleShot});
 }
 
 template <typename... Args>
@@ -182,6 +321,104 @@ Expected<void> Event<Args...>::wait(const std::chrono::duration<Rep, Period>& ti
     }
 }
 
+template <typename... Args>
+EventStatistics Event<Args...>::statistics() const
+{
+    return profiler().statistics();
+}
+
+// ===========================================================================================================
+
+#ifdef FTY_EVENT_PROFILING
+
+inline details::EventProfiler::EventProfiler(const std::string& name)
+    : m_name(name)
+{
+    std::lock_guard<std::mutex> lock(registryMutex());
+    registry().insert(this);
+}
+
+inline details::EventProfiler::EventProfiler(const EventProfiler& other)
+    : EventProfiler(other.m_name)
+{
+}
+
+inline details::EventProfiler::~EventProfiler()
+{
+    std::lock_guard<std::mutex> lock(registryMutex());
+    registry().erase(this);
+}
+
+inline details::EventProfiler::Stamp details::EventProfiler::now()
+{
+    return std::chrono::steady_clock::now();
+}
+
+inline void details::EventProfiler::lockAcquired(Stamp start) const
+{
+    m_lockWaitTime += std::chrono::duration_cast<std::chrono::nanoseconds>(now() - start).count();
+}
+
+inline void details::EventProfiler::slotCalled(Stamp start) const
+{
+    int64_t spent = std::chrono::duration_cast<std::chrono::nanoseconds>(now() - start).count();
+    m_slotsTime += spent;
+
+    int64_t max = m_maxSlotTime;
+    while (spent > max && !m_maxSlotTime.compare_exchange_weak(max, spent)) {
+    }
+}
+
+inline void details::EventProfiler::emitted(size_t listeners) const
+{
+    ++m_emitCount;
+    m_listenerCount = listeners;
+}
+
+inline EventStatistics details::EventProfiler::statistics() const
+{
+    EventStatistics stat;
+    stat.name          = m_name;
+    stat.emitCount     = m_emitCount;
+    stat.listenerCount = m_listenerCount;
+    stat.slotsTime     = std::chrono::nanoseconds(m_slotsTime);
+    stat.maxSlotTime   = std::chrono::nanoseconds(m_maxSlotTime);
+    stat.lockWaitTime  = std::chrono::nanoseconds(m_lockWaitTime);
+    return stat;
+}
+
+inline std::mutex& details::EventProfiler::registryMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+inline std::set<details::EventProfiler*>& details::EventProfiler::registry()
+{
+    static std::set<EventProfiler*> reg;
+    return reg;
+}
+
+inline std::vector<EventStatistics> eventStatistics()
+{
+    std::vector<EventStatistics> ret;
+
+    std::lock_guard<std::mutex> lock(details::EventProfiler::registryMutex());
+    for (const auto* profiler : details::EventProfiler::registry()) {
+        ret.push_back(profiler->statistics());
+    }
+    return ret;
+}
+
+#else
+
+inline std::vector<EventStatistics> eventStatistics()
+{
+    return {};
+}
+
+#endif
+
 // ===========================================================================================================
 
 template <typename... Args>
@@ -229,9 +466,9 @@ Slot<Args...>::~Slot()
 }
 
 template <typename... Args>
-void Slot<Args...>::connect(Event<Args...>& signal)
+void Slot<Args...>::connect(Event<Args...>& signal, int priority, bool singleShot)
 {
-    signal.connect(*this);
+    signal.connect(*this, priority, singleShot);
 }
 
 // ===========================================================================================================
@@ -17,6 +17,7 @@
 #include "convert.h"
 #include <cassert>
 #include <fmt/format.h>
+#include <new>
 #include <optional>
 #include <string>
 
@@ -120,7 +121,12 @@ template <typename... Args>
 inline Unexpected<std::string> unexpected(const std::string& fmt, const Args&... args)
 {
     try {
+#if FMT_VERSION >= 80000
+        // Format string is a runtime value, compile time check (C++20) does not apply
+        return {fmt::format(fmt::runtime(fmt), args...)};
+#else
         return {fmt::format(fmt, args...)};
+#endif
     } catch (const fmt::format_error&) {
         assert("Format error");
         return fmt;
@@ -152,9 +158,9 @@ constexpr Expected<T, ErrorT>::Expected(Expected&& other) noexcept
 {
     if (other.m_isError) {
         m_isError = true;
-        m_error   = std::move(other.m_error);
+        new (&m_error) ErrorT(std::move(other.m_error));
     } else {
-        m_value = std::move(other.m_value);
+        new (&m_value) T(std::move(other.m_value));
     }
 }
 
@@ -0,0 +1,497 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+#pragma once
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <fty/event.h>
+#include <fty/expected.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <tuple>
+#include <unistd.h>
+
+namespace fty {
+
+// ===========================================================================================================
+
+namespace details {
+
+    /// Shared memory layout of the ipc event. Followed by `capacity` cells of `cellSize` bytes.
+    struct IpcEventHeader
+    {
+        std::atomic<uint32_t> magic;
+        uint32_t              capacity;
+        uint32_t              cellSize;
+        uint32_t              payloadSize;
+        pthread_mutex_t       mutex;
+        std::atomic<uint64_t> head;
+        std::atomic<uint32_t> futex;
+    };
+
+    /// One ring buffer cell, payload follows the sequence number.
+    struct IpcEventCell
+    {
+        std::atomic<uint64_t> seq;
+    };
+
+    constexpr uint32_t IpcEventMagic = 0x66747945;
+
+    /// Where shm_open() keeps named shared memory
+    constexpr const char* IpcEventShmDir = "/dev/shm";
+
+    inline int futexWait(std::atomic<uint32_t>* addr, uint32_t expected, const timespec* timeout)
+    {
+        return int(syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT, expected, timeout, nullptr, 0));
+    }
+
+    inline void futexWakeAll(std::atomic<uint32_t>* addr)
+    {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+
+} // namespace details
+
+// ===========================================================================================================
+
+/// Cross-process variant of Event.
+/// Payloads are passed through a named shared memory ring buffer, waiters are woken up with a futex living
+/// in the same memory. Every instance opened with the same name (in any process) receives all the events
+/// emitted after it was opened. Arguments must be trivially copyable.
+/// If a reader is too slow and ring buffer wraps, the oldest not yet read events are lost.
+template <typename... Args>
+class IpcEvent
+{
+public:
+    /// Creates ipc event object, call open() to attach it to shared memory
+    /// @param name shared memory name
+    /// @param capacity ring buffer size, used only by the process which creates the shared memory
+    IpcEvent(const std::string& name, uint32_t capacity = 64);
+    ~IpcEvent();
+
+    IpcEvent(const IpcEvent&) = delete;
+    IpcEvent& operator=(const IpcEvent&) = delete;
+
+    /// Creates or attaches to the shared memory. Shared memory is published under its name only once it is
+    /// initialized, uninitialized one found under the name is stale and is replaced.
+    Expected<void> open();
+
+    /// Emits event to all the listeners in all the processes
+    void operator()(Args&&... args) const;
+
+    /// Connects local slot, slot will be called from dispatch() or wait()
+    void connect(Slot<Args...>& slot);
+
+    /// Calls connected slots for all the pending events without blocking
+    /// @return number of dispatched events
+    size_t dispatch();
+
+    /// Waits for the events and dispatches them
+    void wait();
+
+    /// Waits for the events and dispatches them
+    Expected<void> wait(int msecTimeout);
+
+    /// Waits for the events and dispatches them
+    template <typename Rep, typename Period>
+    Expected<void> wait(const std::chrono::duration<Rep, Period>& timeout);
+
+    /// Removes shared memory with given name
+    static void unlink(const std::string& name);
+
+private:
+    using Payload     = std::tuple<std::decay_t<Args>...>;
+    using Connections = std::vector<std::weak_ptr<typename Slot<Args...>::Impl>>;
+
+    static_assert((std::is_trivially_copyable_v<std::decay_t<Args>> && ...), "IpcEvent arguments must be trivially copyable");
+    static_assert(
+        (std::is_default_constructible_v<std::decay_t<Args>> && ...), "IpcEvent arguments must be default constructible");
+
+    static constexpr size_t cellSize();
+    static std::string      shmName(const std::string& name);
+
+    /// Creates initialized shared memory and links it under the name, false if the name exists already
+    Expected<bool>         create();
+    /// Attaches to the shared memory, closes fd on failure. Stale is set to its inode if it is not initialized.
+    Expected<void>         attach(int fd, ino_t& stale);
+    details::IpcEventCell* cell(uint64_t index) const;
+    bool                   read(uint64_t index, Payload& payload) const;
+    void                   call(Payload& payload);
+
+    template <size_t... Idx>
+    void call(typename Slot<Args...>::Impl& slot, Payload& payload, std::index_sequence<Idx...>);
+
+private:
+    std::string              m_name;
+    uint32_t                 m_capacity;
+    int                      m_fd     = -1;
+    size_t                   m_size   = 0;
+    details::IpcEventHeader* m_header = nullptr;
+    uint64_t                 m_cursor = 0;
+    Connections              m_connections;
+    std::mutex               m_mutex;
+    std::atomic<bool>        m_stopped = false;
+};
+
+// ===========================================================================================================
+
+template <typename... Args>
+IpcEvent<Args...>::IpcEvent(const std::string& name, uint32_t capacity)
+    : m_name(shmName(name))
+    , m_capacity(capacity ? capacity : 1)
+{
+}
+
+template <typename... Args>
+IpcEvent<Args...>::~IpcEvent()
+{
+    if (m_header) {
+        m_stopped = true;
+        details::futexWakeAll(&m_header->futex);
+        munmap(m_header, m_size);
+    }
+    if (m_fd != -1) {
+        close(m_fd);
+    }
+}
+
+template <typename... Args>
+Expected<void> IpcEvent<Args...>::open()
+{
+    if (m_header) {
+        return {};
+    }
+
+    // Creators and stale memory removal can race with us, a few rounds settle it
+    for (int attempt = 0; attempt < 8; ++attempt) {
+        int fd = shm_open(m_name.c_str(), O_RDWR, 0660);
+        if (fd == -1 && errno != ENOENT) {
+            return unexpected("shm_open failed: {}", strerror(errno));
+        }
+
+        if (fd == -1) {
+            auto created = create();
+            if (!created) {
+                return unexpected(created.error());
+            } else if (*created) {
+                return {};
+            }
+            // Other process was faster
+            continue;
+        }
+
+        ino_t stale = 0;
+        if (auto ret = attach(fd, stale); ret) {
+            return {};
+        } else if (!stale) {
+            return unexpected(ret.error());
+        }
+
+        // Never published by IpcEvent, removed only if the name still refers to the same memory
+        fd = shm_open(m_name.c_str(), O_RDONLY, 0);
+        if (fd != -1) {
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_ino == stale) {
+                shm_unlink(m_name.c_str());
+            }
+            close(fd);
+        }
+    }
+    return unexpected("cannot open shared memory {}", m_name);
+}
+
+template <typename... Args>
+Expected<bool> IpcEvent<Args...>::create()
+{
+    // Initialized as an unnamed file and linked under the name afterwards: nobody ever sees it half done and
+    // a creator dying meanwhile leaves nothing behind
+    int fd = ::open(details::IpcEventShmDir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0660);
+    if (fd == -1) {
+        return unexpected("cannot create shared memory: {}", strerror(errno));
+    }
+
+    size_t size = sizeof(details::IpcEventHeader) + m_capacity * cellSize();
+    if (ftruncate(fd, off_t(size)) == -1) {
+        int error = errno;
+        close(fd);
+        return unexpected("ftruncate failed: {}", strerror(error));
+    }
+
+    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        int error = errno;
+        close(fd);
+        return unexpected("mmap failed: {}", strerror(error));
+    }
+    auto header = static_cast<details::IpcEventHeader*>(mem);
+
+    header->capacity    = m_capacity;
+    header->cellSize    = uint32_t(cellSize());
+    header->payloadSize = uint32_t(sizeof(Payload));
+    header->head        = 0;
+    header->futex       = 0;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&header->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    header->magic.store(details::IpcEventMagic, std::memory_order_release);
+
+    auto source = fmt::format("/proc/self/fd/{}", fd);
+    auto target = std::string(details::IpcEventShmDir) + m_name;
+    if (linkat(AT_FDCWD, source.c_str(), AT_FDCWD, target.c_str(), AT_SYMLINK_FOLLOW) == -1) {
+        int error = errno;
+        munmap(mem, size);
+        close(fd);
+        if (error == EEXIST) {
+            return false;
+        }
+        return unexpected("cannot publish shared memory {}: {}", m_name, strerror(error));
+    }
+
+    m_fd     = fd;
+    m_size   = size;
+    m_header = header;
+    m_cursor = 0;
+    return true;
+}
+
+template <typename... Args>
+Expected<void> IpcEvent<Args...>::attach(int fd, ino_t& stale)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        int error = errno;
+        close(fd);
+        return unexpected("fstat failed: {}", strerror(error));
+    }
+    if (size_t(st.st_size) < sizeof(details::IpcEventHeader)) {
+        stale = st.st_ino;
+        close(fd);
+        return unexpected("shared memory {} is not initialized", m_name);
+    }
+    size_t size = size_t(st.st_size);
+
+    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        int error = errno;
+        close(fd);
+        return unexpected("mmap failed: {}", strerror(error));
+    }
+    auto header = static_cast<details::IpcEventHeader*>(mem);
+
+    if (header->magic.load(std::memory_order_acquire) != details::IpcEventMagic) {
+        stale = st.st_ino;
+        munmap(mem, size);
+        close(fd);
+        return unexpected("shared memory {} is not initialized", m_name);
+    }
+    if (header->payloadSize != sizeof(Payload) || header->cellSize != cellSize() ||
+        size < sizeof(details::IpcEventHeader) + header->capacity * cellSize()) {
+        munmap(mem, size);
+        close(fd);
+        return unexpected("shared memory {} has incompatible layout", m_name);
+    }
+
+    m_fd       = fd;
+    m_size     = size;
+    m_capacity = header->capacity;
+    m_header   = header;
+    m_cursor   = m_header->head.load(std::memory_order_acquire);
+    return {};
+}
+
+template <typename... Args>
+void IpcEvent<Args...>::operator()(Args&&... args) const
+{
+    if (!m_header) {
+        return;
+    }
+
+    Payload payload(std::forward<Args>(args)...);
+
+    if (pthread_mutex_lock(&m_header->mutex) == EOWNERDEAD) {
+        // Previous writer died in the middle, cell it was writing is protected by sequence number
+        pthread_mutex_consistent(&m_header->mutex);
+    }
+
+    uint64_t index = m_header->head.load(std::memory_order_relaxed);
+    auto     cl    = cell(index);
+
+    cl->seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(reinterpret_cast<char*>(cl) + sizeof(details::IpcEventCell), &payload, sizeof(Payload));
+    cl->seq.store(index + 1, std::memory_order_release);
+
+    m_header->head.store(index + 1, std::memory_order_release);
+    m_header->futex.fetch_add(1, std::memory_order_release);
+
+    pthread_mutex_unlock(&m_header->mutex);
+
+    details::futexWakeAll(&m_header->futex);
+}
+
+template <typename... Args>
+void IpcEvent<Args...>::connect(Slot<Args...>& slot)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_connections.emplace_back(slot.m_impl);
+}
+
+template <typename... Args>
+size_t IpcEvent<Args...>::dispatch()
+{
+    if (!m_header) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    size_t   count = 0;
+    uint64_t head  = m_header->head.load(std::memory_order_acquire);
+    if (head - m_cursor > m_capacity) {
+        m_cursor = head - m_capacity;
+    }
+
+    Payload payload;
+    for (; m_cursor < head; ++m_cursor) {
+        if (read(m_cursor, payload)) {
+            call(payload);
+            ++count;
+        }
+    }
+    return count;
+}
+
+template <typename... Args>
+void IpcEvent<Args...>::wait()
+{
+    while (!m_stopped && m_header) {
+        uint32_t seq = m_header->futex.load(std::memory_order_acquire);
+        if (dispatch()) {
+            return;
+        }
+        details::futexWait(&m_header->futex, seq, nullptr);
+    }
+}
+
+template <typename... Args>
+Expected<void> IpcEvent<Args...>::wait(int mSecTimeout)
+{
+    return wait(std::chrono::milliseconds(mSecTimeout));
+}
+
+template <typename... Args>
+template <typename Rep, typename Period>
+Expected<void> IpcEvent<Args...>::wait(const std::chrono::duration<Rep, Period>& timeout)
+{
+    if (!m_header) {
+        return unexpected("not opened");
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!m_stopped) {
+        uint32_t seq = m_header->futex.load(std::memory_order_acquire);
+        if (dispatch()) {
+            return {};
+        }
+
+        auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0) {
+            return unexpected("timeout");
+        }
+
+        timespec ts;
+        ts.tv_sec  = time_t(left.count() / 1000000000);
+        ts.tv_nsec = long(left.count() % 1000000000);
+        details::futexWait(&m_header->futex, seq, &ts);
+    }
+    return {};
+}
+
+template <typename... Args>
+void IpcEvent<Args...>::unlink(const std::string& name)
+{
+    shm_unlink(shmName(name).c_str());
+}
+
+template <typename... Args>
+constexpr size_t IpcEvent<Args...>::cellSize()
+{
+    // Keep cells on separate cache lines
+    return (sizeof(details::IpcEventCell) + sizeof(Payload) + 63) & ~size_t(63);
+}
+
+template <typename... Args>
+std::string IpcEvent<Args...>::shmName(const std::string& name)
+{
+    return !name.empty() && name[0] == '/' ? name : "/" + name;
+}
+
+template <typename... Args>
+details::IpcEventCell* IpcEvent<Args...>::cell(uint64_t index) const
+{
+    auto base = reinterpret_cast<char*>(m_header) + sizeof(details::IpcEventHeader);
+    return reinterpret_cast<details::IpcEventCell*>(base + (index % m_capacity) * cellSize());
+}
+
+template <typename... Args>
+bool IpcEvent<Args...>::read(uint64_t index, Payload& payload) const
+{
+    auto cl = cell(index);
+    if (cl->seq.load(std::memory_order_acquire) != index + 1) {
+        // Overwritten by a newer event
+        return false;
+    }
+    memcpy(static_cast<void*>(&payload), reinterpret_cast<char*>(cl) + sizeof(details::IpcEventCell), sizeof(Payload));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return cl->seq.load(std::memory_order_relaxed) == index + 1;
+}
+
+template <typename... Args>
+void IpcEvent<Args...>::call(Payload& payload)
+{
+    for (auto iter = m_connections.begin(); iter != m_connections.end();) {
+        if (auto caller = iter->lock()) {
+            call(*caller, payload, std::index_sequence_for<Args...>());
+            ++iter;
+        } else {
+            iter = m_connections.erase(iter);
+        }
+    }
+}
+
+template <typename... Args>
+template <size_t... Idx>
+void IpcEvent<Args...>::call(typename Slot<Args...>::Impl& slot, Payload& payload, std::index_sequence<Idx...>)
+{
+    // Every slot gets its own copy, as it can modify the arguments
+    Payload copy = payload;
+    slot.call(std::forward<Args>(std::get<Idx>(copy))...);
+}
+
+// ===========================================================================================================
+
+} // namespace fty
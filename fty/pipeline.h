@@ -0,0 +1,200 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+#pragma once
+#include <fty/process.h>
+#include <memory>
+#include <vector>
+
+namespace fty {
+
+// =========================================================================================================================================
+
+/// Runs `cmd1 | cmd2 | cmd3` without a shell. Stages are connected to each other with pipes directly, data
+/// never goes through the parent. Standard input can be captured on the first stage, standard output and
+/// error on the last one.
+class Pipeline
+{
+public:
+    Pipeline(Capture capture = Capture::Out | Capture::Err);
+
+    /// Adds next stage
+    Pipeline& add(const std::string& cmd, const Process::Arguments& args = {});
+
+    /// Starts all the stages
+    Expected<void> run();
+
+    /// Waits for all the stages
+    /// @return exit code of every stage, in order
+    Expected<std::vector<int>> wait();
+
+    /// Returns number of stages
+    size_t size() const;
+
+    /// Returns first stage, to write to the pipeline. Valid after run().
+    Process& first();
+
+    /// Returns last stage, to read pipeline output. Valid after run().
+    Process& last();
+
+public:
+    /// Runs pipeline and captures its output
+    /// @return exit code of every stage, in order
+    static Expected<std::vector<int>> run(const std::vector<Process::Arguments>& stages, std::string& out);
+
+private:
+    struct Stage
+    {
+        std::string        cmd;
+        Process::Arguments args;
+    };
+
+    Capture                               m_capture;
+    std::vector<Stage>                    m_stages;
+    std::vector<std::unique_ptr<Process>> m_processes;
+};
+
+// =========================================================================================================================================
+
+inline Pipeline::Pipeline(Capture capture)
+    : m_capture(capture)
+{
+}
+
+inline Pipeline& Pipeline::add(const std::string& cmd, const Process::Arguments& args)
+{
+    m_stages.push_back({cmd, args});
+    return *this;
+}
+
+inline Expected<void> Pipeline::run()
+{
+    if (m_stages.empty()) {
+        return unexpected("pipeline is empty");
+    }
+    if (!m_processes.empty()) {
+        return unexpected("pipeline is already running");
+    }
+
+    int input = -1;
+    for (size_t i = 0; i < m_stages.size(); ++i) {
+        bool isFirst = i == 0;
+        bool isLast  = i + 1 == m_stages.size();
+
+        Capture capture = Capture::None;
+        if (isFirst && isSet(m_capture, Capture::In)) {
+            capture |= Capture::In;
+        }
+        if (isLast) {
+            capture |= m_capture & (Capture::Out | Capture::Err);
+        }
+
+        auto& proc = m_processes.emplace_back(std::make_unique<Process>(m_stages[i].cmd, m_stages[i].args, capture));
+
+        // Close on exec, so no other stage keeps the pipe open
+        int fds[2] = {-1, -1};
+        if (!isLast && pipe2(fds, O_CLOEXEC) == -1) {
+            if (input != -1) {
+                close(input);
+            }
+            m_processes.clear();
+            return unexpected("pipe failed: {}", strerror(errno));
+        }
+
+        proc->setStandardInput(input);
+        proc->setStandardOutput(fds[1]);
+
+        auto ret = proc->run();
+
+        if (input != -1) {
+            close(input);
+        }
+        if (fds[1] != -1) {
+            close(fds[1]);
+        }
+        input = fds[0];
+
+        if (!ret) {
+            if (input != -1) {
+                close(input);
+            }
+            // Already started stages are killed
+            m_processes.clear();
+            return unexpected("stage {} ({}): {}", i, m_stages[i].cmd, ret.error());
+        }
+    }
+    return {};
+}
+
+inline Expected<std::vector<int>> Pipeline::wait()
+{
+    if (m_processes.empty()) {
+        return unexpected("pipeline is not running");
+    }
+
+    std::vector<int> codes;
+    codes.reserve(m_processes.size());
+    for (auto& proc : m_processes) {
+        auto ret = proc->wait();
+        if (!ret) {
+            return unexpected(ret.error());
+        }
+        codes.push_back(*ret);
+    }
+    return codes;
+}
+
+inline size_t Pipeline::size() const
+{
+    return m_stages.size();
+}
+
+inline Process& Pipeline::first()
+{
+    assert(!m_processes.empty());
+    return *m_processes.front();
+}
+
+inline Process& Pipeline::last()
+{
+    assert(!m_processes.empty());
+    return *m_processes.back();
+}
+
+inline Expected<std::vector<int>> Pipeline::run(const std::vector<Process::Arguments>& stages, std::string& out)
+{
+    Pipeline pipeline(Capture::Out);
+    for (const auto& stage : stages) {
+        if (stage.empty()) {
+            return unexpected("empty stage");
+        }
+        pipeline.add(stage.front(), Process::Arguments(stage.begin() + 1, stage.end()));
+    }
+
+    if (auto ret = pipeline.run(); !ret) {
+        return unexpected(ret.error());
+    }
+
+    std::string err;
+    out.clear();
+    if (auto ret = pipeline.last().readAll(out, err); !ret) {
+        return unexpected(ret.error());
+    }
+    return pipeline.wait();
+}
+
+// =========================================================================================================================================
+
+} // namespace fty
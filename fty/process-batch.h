@@ -0,0 +1,293 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+#pragma once
+#include <fty/event.h>
+#include <fty/process.h>
+#include <memory>
+#include <vector>
+
+namespace fty {
+
+// =========================================================================================================================================
+
+/// Runs a list of commands with at most N of them at once.
+/// Everything is done in the calling thread with one poll loop: child exits (pidfd) start next commands,
+/// pipe readiness fills the output of running ones. No thread per child is needed.
+class ProcessBatch
+{
+public:
+    /// Result of one command, in the order of add()
+    struct Result
+    {
+        /// Command ran to its end and was reaped
+        bool finished = false;
+        /// Spawn error, or timeout if the command was killed
+        std::string error;
+        /// Exit code (or signal number)
+        int exitCode = -1;
+        /// Captured standard output
+        std::string out;
+        /// Captured standard error
+        std::string err;
+        /// Timing and resources used by the command
+        ResourceUsage usage;
+    };
+
+public:
+    /// Command finished or failed to start (index of the command), fired from run()
+    Event<size_t> commandFinished;
+
+public:
+    /// @param maxRunning maximum number of commands running at once
+    /// @param capture captured streams of every command, standard input is never captured
+    ProcessBatch(size_t maxRunning, Capture capture = Capture::Out | Capture::Err);
+
+    /// Adds a command
+    ProcessBatch& add(const std::string& cmd, const Process::Arguments& args = {});
+
+    /// Runs all the commands and waits for them
+    /// @param milliseconds per command timeout, command is killed after it, -1 for no timeout
+    Expected<void> run(int milliseconds = -1);
+
+    /// Returns results, one per added command
+    const std::vector<Result>& results() const;
+
+    /// Returns number of commands
+    size_t size() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Command
+    {
+        std::string        cmd;
+        Process::Arguments args;
+    };
+
+    struct Running
+    {
+        size_t                   index;
+        std::unique_ptr<Process> process;
+        int                      pidfd    = -1;
+        bool                     outOpen  = false;
+        bool                     errOpen  = false;
+        bool                     timedOut = false;
+        Clock::time_point        deadline = Clock::time_point::max();
+    };
+
+    void start(size_t index, int milliseconds);
+    void finish(Running& running);
+    int  nextTimeout() const;
+
+    /// Reads everything available, returns false on end of stream
+    static bool readAvailable(int fd, std::string& output);
+
+private:
+    size_t               m_maxRunning;
+    Capture              m_capture;
+    std::vector<Command> m_commands;
+    std::vector<Result>  m_results;
+    std::vector<Running> m_running;
+};
+
+// =========================================================================================================================================
+
+inline ProcessBatch::ProcessBatch(size_t maxRunning, Capture capture)
+    : m_maxRunning(maxRunning ? maxRunning : 1)
+    , m_capture(capture & (Capture::Out | Capture::Err))
+{
+}
+
+inline ProcessBatch& ProcessBatch::add(const std::string& cmd, const Process::Arguments& args)
+{
+    m_commands.push_back({cmd, args});
+    return *this;
+}
+
+inline Expected<void> ProcessBatch::run(int milliseconds)
+{
+    if (!m_running.empty()) {
+        return unexpected("batch is already running");
+    }
+
+    m_results.clear();
+    m_results.resize(m_commands.size());
+    m_running.reserve(std::min(m_maxRunning, m_commands.size()));
+
+    std::vector<pollfd> fds;
+    fds.reserve(m_maxRunning * 3);
+
+    size_t next = 0;
+    while (next < m_commands.size() || !m_running.empty()) {
+        while (m_running.size() < m_maxRunning && next < m_commands.size()) {
+            start(next++, milliseconds);
+        }
+        if (m_running.empty()) {
+            continue;
+        }
+
+        fds.clear();
+        for (const auto& running : m_running) {
+            fds.push_back({running.pidfd, POLLIN, 0});
+            fds.push_back({running.outOpen ? running.process->m_stdout : -1, POLLIN, 0});
+            fds.push_back({running.errOpen ? running.process->m_stderr : -1, POLLIN, 0});
+        }
+
+        if (poll(fds.data(), fds.size(), nextTimeout()) == -1 && errno != EINTR) {
+            return unexpected("poll failed: {}", strerror(errno));
+        }
+
+        auto now = Clock::now();
+        for (size_t i = 0; i < m_running.size();) {
+            auto& running = m_running[i];
+            auto& result  = m_results[running.index];
+
+            if (running.outOpen && fds[i * 3 + 1].revents) {
+                running.outOpen = readAvailable(running.process->m_stdout, result.out);
+            }
+            if (running.errOpen && fds[i * 3 + 2].revents) {
+                running.errOpen = readAvailable(running.process->m_stderr, result.err);
+            }
+
+            if (fds[i * 3].revents) {
+                finish(running);
+                // Keep fds in step with m_running
+                m_running.erase(m_running.begin() + long(i));
+                fds.erase(fds.begin() + long(i * 3), fds.begin() + long(i * 3 + 3));
+                continue;
+            }
+
+            if (!running.timedOut && running.deadline <= now) {
+                running.timedOut = true;
+                ::kill(running.process->m_pid, SIGKILL);
+            }
+            ++i;
+        }
+    }
+    return {};
+}
+
+inline const std::vector<ProcessBatch::Result>& ProcessBatch::results() const
+{
+    return m_results;
+}
+
+inline size_t ProcessBatch::size() const
+{
+    return m_commands.size();
+}
+
+inline void ProcessBatch::start(size_t index, int milliseconds)
+{
+    const auto& command = m_commands[index];
+    auto&       result  = m_results[index];
+
+    Running running;
+    running.index   = index;
+    running.process = std::make_unique<Process>(command.cmd, command.args, m_capture);
+
+    if (auto ret = running.process->run(); !ret) {
+        result.error = ret.error();
+        commandFinished(size_t(index));
+        return;
+    }
+
+    running.pidfd = details::pidfdOpen(running.process->m_pid);
+    if (running.pidfd == -1) {
+        result.error = fmt::format("pidfd_open failed: {}", strerror(errno));
+        running.process->kill();
+        commandFinished(size_t(index));
+        return;
+    }
+
+    running.outOpen = isSet(m_capture, Capture::Out);
+    running.errOpen = isSet(m_capture, Capture::Err);
+    for (int fd : {running.process->m_stdout, running.process->m_stderr}) {
+        if (fd > 0) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        }
+    }
+
+    if (milliseconds >= 0) {
+        running.deadline = Clock::now() + std::chrono::milliseconds(milliseconds);
+    }
+    m_running.push_back(std::move(running));
+}
+
+inline void ProcessBatch::finish(Running& running)
+{
+    auto& result = m_results[running.index];
+
+    // Everything written before the exit is in the pipes already. Descendants which keep the pipes open are
+    // not waited for.
+    if (running.outOpen) {
+        readAvailable(running.process->m_stdout, result.out);
+    }
+    if (running.errOpen) {
+        readAvailable(running.process->m_stderr, result.err);
+    }
+    close(running.pidfd);
+
+    if (auto ret = running.process->wait(result.usage); ret) {
+        result.exitCode = *ret;
+        result.finished = !running.timedOut;
+        if (running.timedOut) {
+            result.error = "timeout";
+        }
+    } else {
+        result.error = ret.error();
+    }
+    commandFinished(size_t(running.index));
+}
+
+inline int ProcessBatch::nextTimeout() const
+{
+    auto next = Clock::time_point::max();
+    for (const auto& running : m_running) {
+        if (!running.timedOut) {
+            next = std::min(next, running.deadline);
+        }
+    }
+
+    if (next == Clock::time_point::max()) {
+        return -1;
+    }
+
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(next - Clock::now()).count();
+    return left > 0 ? int(left) + 1 : 0;
+}
+
+inline bool ProcessBatch::readAvailable(int fd, std::string& output)
+{
+    std::array<char, 4096> buffer;
+    while (true) {
+        auto bytesRead = read(fd, buffer.data(), buffer.size());
+        if (bytesRead > 0) {
+            output.append(buffer.data(), size_t(bytesRead));
+        } else if (bytesRead == 0) {
+            return false;
+        } else if (errno == EINTR) {
+            continue;
+        } else {
+            // EAGAIN: drained for now, anything else: treat as closed
+            return errno == EAGAIN;
+        }
+    }
+}
+
+// =========================================================================================================================================
+
+} // namespace fty
@@ -0,0 +1,228 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+#pragma once
+#include <chrono>
+#include <cstdlib>
+#include <fty/process.h>
+#include <future>
+#include <list>
+#include <map>
+#include <mutex>
+
+namespace fty {
+
+// =========================================================================================================================================
+
+/// Caches results of idempotent commands, like Process::run(cmd, args, out).
+/// Results are keyed by command, arguments and values of the selected environment variables. Only successful
+/// runs are cached (whatever the exit code), for the TTL. Concurrent identical requests share one child.
+class ProcessCache
+{
+public:
+    struct Statistics
+    {
+        /// Answered from the cache
+        size_t hits = 0;
+        /// Child was started
+        size_t misses = 0;
+        /// Waited for a child started by an identical request
+        size_t coalesced = 0;
+        /// Dropped because of the size bound
+        size_t evictions = 0;
+    };
+
+public:
+    /// @param ttl time to keep a result
+    /// @param maxEntries maximum number of cached results, least recently used are dropped first
+    /// @param environment names of environment variables which are part of the key
+    ProcessCache(std::chrono::milliseconds ttl = std::chrono::seconds(10), size_t maxEntries = 128,
+        const std::vector<std::string>& environment = {});
+
+    ProcessCache(const ProcessCache&) = delete;
+    ProcessCache& operator=(const ProcessCache&) = delete;
+
+    /// Runs the command or returns its cached result
+    /// @param out standard output of the command
+    /// @return exit code
+    Expected<int> run(const std::string& cmd, const Process::Arguments& args, std::string& out);
+
+    /// Drops all the cached results
+    void clear();
+
+    /// Returns number of cached results
+    size_t size() const;
+
+    /// Returns hit and miss counters
+    Statistics statistics() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Result
+    {
+        std::string error;
+        int         code = 0;
+        std::string out;
+    };
+
+    struct Entry
+    {
+        Clock::time_point                expires;
+        std::shared_ptr<const Result>    result;
+        std::list<std::string>::iterator lru;
+    };
+
+    using Future = std::shared_future<std::shared_ptr<const Result>>;
+
+    std::string   key(const std::string& cmd, const Process::Arguments& args) const;
+    Expected<int> answer(const Result& result, std::string& out) const;
+
+private:
+    std::chrono::milliseconds     m_ttl;
+    size_t                        m_maxEntries;
+    std::vector<std::string>      m_environment;
+    std::map<std::string, Entry>  m_entries;
+    std::map<std::string, Future> m_running;
+    std::list<std::string>        m_lru;
+    Statistics                    m_statistics;
+    mutable std::mutex            m_mutex;
+};
+
+// =========================================================================================================================================
+
+inline ProcessCache::ProcessCache(std::chrono::milliseconds ttl, size_t maxEntries, const std::vector<std::string>& environment)
+    : m_ttl(ttl)
+    , m_maxEntries(maxEntries)
+    , m_environment(environment)
+{
+}
+
+inline Expected<int> ProcessCache::run(const std::string& cmd, const Process::Arguments& args, std::string& out)
+{
+    auto id = key(cmd, args);
+
+    std::promise<std::shared_ptr<const Result>> promise;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        if (auto it = m_entries.find(id); it != m_entries.end()) {
+            if (it->second.expires > Clock::now()) {
+                ++m_statistics.hits;
+                m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+                auto result = it->second.result;
+                lock.unlock();
+                return answer(*result, out);
+            }
+            m_lru.erase(it->second.lru);
+            m_entries.erase(it);
+        }
+
+        if (auto it = m_running.find(id); it != m_running.end()) {
+            ++m_statistics.coalesced;
+            auto future = it->second;
+            lock.unlock();
+            return answer(*future.get(), out);
+        }
+
+        ++m_statistics.misses;
+        m_running.emplace(id, promise.get_future().share());
+    }
+
+    std::shared_ptr<Result> result;
+    try {
+        result = std::make_shared<Result>();
+        if (auto ret = Process::run(cmd, args, result->out); ret) {
+            result->code = *ret;
+        } else {
+            result->error = ret.error();
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running.erase(id);
+
+        if (result->error.empty() && m_maxEntries && m_ttl.count() > 0) {
+            while (m_entries.size() >= m_maxEntries) {
+                m_entries.erase(m_lru.back());
+                m_lru.pop_back();
+                ++m_statistics.evictions;
+            }
+            m_lru.push_front(id);
+            m_entries[id] = {Clock::now() + m_ttl, result, m_lru.begin()};
+        }
+    } catch (...) {
+        // Coalesced callers get the same exception, later calls run the command again
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running.erase(id);
+        }
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+
+    promise.set_value(result);
+    return answer(*result, out);
+}
+
+inline void ProcessCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+    m_lru.clear();
+}
+
+inline size_t ProcessCache::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+}
+
+inline ProcessCache::Statistics ProcessCache::statistics() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_statistics;
+}
+
+inline std::string ProcessCache::key(const std::string& cmd, const Process::Arguments& args) const
+{
+    // Zero byte can not be a part of any argument or variable
+    std::string id = cmd;
+    for (const auto& arg : args) {
+        id += '\0';
+        id += arg;
+    }
+    id += '\0';
+    for (const auto& name : m_environment) {
+        id += '\0';
+        if (const char* value = getenv(name.c_str())) {
+            id += '=';
+            id += value;
+        }
+    }
+    return id;
+}
+
+inline Expected<int> ProcessCache::answer(const Result& result, std::string& out) const
+{
+    if (!result.error.empty()) {
+        return unexpected(result.error);
+    }
+    out = result.out;
+    return result.code;
+}
+
+// =========================================================================================================================================
+
+} // namespace fty
@@ -0,0 +1,625 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+#pragma once
+#include <fty/process.h>
+
+// Coroutines need C++20, the header is empty otherwise
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <coroutine>
+#include <exception>
+#include <map>
+#include <optional>
+#include <utility>
+#include <sys/epoll.h>
+#include <vector>
+
+namespace fty {
+
+// =========================================================================================================================================
+
+template <typename T = void>
+class Task;
+
+namespace details {
+
+    template <typename T>
+    class TaskPromiseBase
+    {
+    public:
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept
+            {
+                return false;
+            }
+
+            template <typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+            {
+                if (auto continuation = handle.promise().continuation) {
+                    return continuation;
+                }
+                return std::noop_coroutine();
+            }
+
+            void await_resume() noexcept
+            {
+            }
+        };
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        FinalAwaiter final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void unhandled_exception()
+        {
+            exception = std::current_exception();
+        }
+
+        std::coroutine_handle<> continuation;
+        std::exception_ptr      exception;
+    };
+
+    template <typename T>
+    class TaskPromise : public TaskPromiseBase<T>
+    {
+    public:
+        Task<T> get_return_object();
+
+        template <typename U>
+        void return_value(U&& value)
+        {
+            result.emplace(std::forward<U>(value));
+        }
+
+        T take()
+        {
+            if (this->exception) {
+                std::rethrow_exception(this->exception);
+            }
+            return std::move(*result);
+        }
+
+        std::optional<T> result;
+    };
+
+    template <>
+    class TaskPromise<void> : public TaskPromiseBase<void>
+    {
+    public:
+        Task<void> get_return_object();
+
+        void return_void()
+        {
+        }
+
+        void take()
+        {
+            if (this->exception) {
+                std::rethrow_exception(this->exception);
+            }
+        }
+    };
+
+} // namespace details
+
+// =========================================================================================================================================
+
+/// Lazy coroutine, starts when it is awaited or given to the ProcessReactor
+template <typename T>
+class Task
+{
+public:
+    using promise_type = details::TaskPromise<T>;
+    using Handle       = std::coroutine_handle<promise_type>;
+
+public:
+    explicit Task(Handle handle);
+    Task(Task&& other) noexcept;
+    Task& operator=(Task&& other) noexcept;
+    ~Task();
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    /// Returns if the coroutine has finished
+    bool done() const;
+
+    bool                    await_ready() const noexcept;
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept;
+    T                       await_resume();
+
+private:
+    friend class ProcessReactor;
+    Handle m_handle;
+};
+
+// =========================================================================================================================================
+
+/// Single threaded epoll reactor driving coroutines which wait for child processes.
+/// Child exits are observed through process descriptors (pidfd), output through the captured pipes, so any
+/// number of children is handled without a thread per child.
+/// Output pipes of a process stay registered in epoll while it is read, so awaiting them again costs no
+/// system call. Other descriptors are registered for the time of one co_await.
+/// @note A descriptor can be awaited by one coroutine at a time. Tasks must not be destroyed while suspended.
+/// @note GCC 12 rejects braced initializer lists in co_await expressions ("array used as initializer"), build
+/// the arguments before the co_await.
+class ProcessReactor
+{
+public:
+    /// Result of execute()
+    struct Result
+    {
+        int         exitCode = -1;
+        std::string out;
+        std::string err;
+    };
+
+    /// Suspends the coroutine until one of the descriptors is readable, resumes with that descriptor
+    class Readable
+    {
+    public:
+        Readable(ProcessReactor& reactor, std::vector<int> fds);
+
+        bool await_ready() const noexcept;
+        bool await_suspend(std::coroutine_handle<> handle);
+        int  await_resume() const noexcept;
+
+    private:
+        friend class ProcessReactor;
+
+        ProcessReactor&         m_reactor;
+        std::vector<int>        m_fds;
+        std::coroutine_handle<> m_handle;
+        int                     m_ready = -1;
+    };
+
+public:
+    ProcessReactor();
+    ~ProcessReactor();
+
+    ProcessReactor(const ProcessReactor&) = delete;
+    ProcessReactor& operator=(const ProcessReactor&) = delete;
+
+    /// Waits until one of the descriptors is readable
+    Readable readable(std::vector<int> fds);
+    /// Waits until the descriptor is readable
+    Readable readable(int fd);
+
+    /// Waits for the exit of the running process
+    /// @return exit code, as Process::wait()
+    Task<Expected<int>> exited(Process& process);
+
+    /// Reads next chunk of the captured output of the running process. The pipe stays registered until the
+    /// end of stream, see detach().
+    /// @param channel STDOUT_FILENO or STDERR_FILENO
+    /// @return data, empty on end of stream
+    Task<Expected<std::string>> read(Process& process, int channel = STDOUT_FILENO);
+
+    /// Unregisters output pipes of the process, needed if the process is destroyed before its output was read
+    /// by read() until the end of stream
+    void detach(Process& process);
+
+    /// Runs the command, captures its output and waits for its exit
+    Task<Expected<Result>> execute(std::string cmd, Process::Arguments args = {});
+
+    /// Starts the task, it is owned by the reactor and runs within run()
+    void spawn(Task<void>&& task);
+
+    /// Runs the reactor until all the spawned tasks are done
+    void run();
+
+    /// Runs the reactor until the task is done
+    /// @return result of the task
+    template <typename T>
+    T run(Task<T>&& task);
+
+private:
+    struct Watch
+    {
+        Readable* waiter = nullptr;
+        /// Stays registered after the co_await, see attach()
+        bool persistent = false;
+        /// Registered with EPOLLIN, persistent descriptors are disarmed while nobody waits for them
+        bool armed = false;
+    };
+
+    void poll();
+    bool watch(Readable& waiter);
+    void unwatch(Readable& waiter);
+    void attach(int fd);
+    void detach(int fd);
+    bool waiting() const;
+
+private:
+    int                     m_epoll = -1;
+    std::map<int, Watch>    m_watches;
+    std::vector<Task<void>> m_tasks;
+};
+
+// =========================================================================================================================================
+
+namespace details {
+
+    template <typename T>
+    Task<T> TaskPromise<T>::get_return_object()
+    {
+        return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+    }
+
+    inline Task<void> TaskPromise<void>::get_return_object()
+    {
+        return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+    }
+
+} // namespace details
+
+template <typename T>
+Task<T>::Task(Handle handle)
+    : m_handle(handle)
+{
+}
+
+template <typename T>
+Task<T>::Task(Task&& other) noexcept
+    : m_handle(std::exchange(other.m_handle, nullptr))
+{
+}
+
+template <typename T>
+Task<T>& Task<T>::operator=(Task&& other) noexcept
+{
+    if (this != &other) {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+        m_handle = std::exchange(other.m_handle, nullptr);
+    }
+    return *this;
+}
+
+template <typename T>
+Task<T>::~Task()
+{
+    if (m_handle) {
+        m_handle.destroy();
+    }
+}
+
+template <typename T>
+bool Task<T>::done() const
+{
+    return !m_handle || m_handle.done();
+}
+
+template <typename T>
+bool Task<T>::await_ready() const noexcept
+{
+    return done();
+}
+
+template <typename T>
+std::coroutine_handle<> Task<T>::await_suspend(std::coroutine_handle<> awaiting) noexcept
+{
+    m_handle.promise().continuation = awaiting;
+    return m_handle;
+}
+
+template <typename T>
+T Task<T>::await_resume()
+{
+    return m_handle.promise().take();
+}
+
+// =========================================================================================================================================
+
+inline ProcessReactor::Readable::Readable(ProcessReactor& reactor, std::vector<int> fds)
+    : m_reactor(reactor)
+    , m_fds(std::move(fds))
+{
+}
+
+inline bool ProcessReactor::Readable::await_ready() const noexcept
+{
+    return m_fds.empty();
+}
+
+inline bool ProcessReactor::Readable::await_suspend(std::coroutine_handle<> handle)
+{
+    m_handle = handle;
+    return m_reactor.watch(*this);
+}
+
+inline int ProcessReactor::Readable::await_resume() const noexcept
+{
+    return m_ready;
+}
+
+// =========================================================================================================================================
+
+inline ProcessReactor::ProcessReactor()
+    : m_epoll(epoll_create1(EPOLL_CLOEXEC))
+{
+}
+
+inline ProcessReactor::~ProcessReactor()
+{
+    // Suspended frames are owned by the tasks
+    m_tasks.clear();
+    close(m_epoll);
+}
+
+inline ProcessReactor::Readable ProcessReactor::readable(std::vector<int> fds)
+{
+    return Readable(*this, std::move(fds));
+}
+
+inline ProcessReactor::Readable ProcessReactor::readable(int fd)
+{
+    return Readable(*this, std::vector<int>(1, fd));
+}
+
+inline Task<Expected<int>> ProcessReactor::exited(Process& process)
+{
+    if (!process.m_pid) {
+        co_return unexpected("process is not running");
+    }
+
+    int pidfd = details::pidfdOpen(process.m_pid);
+    if (pidfd == -1) {
+        co_return unexpected("pidfd_open failed: {}", strerror(errno));
+    }
+    co_await readable(pidfd);
+    close(pidfd);
+
+    // Exited already, does not block
+    auto ret = process.wait();
+    if (!ret) {
+        co_return unexpected(ret.error());
+    }
+    co_return *ret;
+}
+
+inline Task<Expected<std::string>> ProcessReactor::read(Process& process, int channel)
+{
+    int fd = channel == STDERR_FILENO ? process.m_stderr : process.m_stdout;
+    if (!fd) {
+        co_return unexpected("channel is not captured");
+    }
+
+    attach(fd);
+
+    std::string chunk(65536, '\0');
+    while (true) {
+        co_await readable(fd);
+        auto bytesRead = ::read(fd, chunk.data(), chunk.size());
+        if (bytesRead > 0) {
+            chunk.resize(size_t(bytesRead));
+            co_return chunk;
+        }
+        if (bytesRead == 0) {
+            detach(fd);
+            co_return std::string();
+        }
+        if (errno != EINTR && errno != EAGAIN) {
+            detach(fd);
+            co_return unexpected("read failed: {}", strerror(errno));
+        }
+    }
+}
+
+inline void ProcessReactor::detach(Process& process)
+{
+    for (int fd : {process.m_stdout, process.m_stderr}) {
+        if (fd) {
+            detach(fd);
+        }
+    }
+}
+
+inline Task<Expected<ProcessReactor::Result>> ProcessReactor::execute(std::string cmd, Process::Arguments args)
+{
+    Process process(cmd, args, Capture::Out | Capture::Err);
+    if (auto ret = process.run(); !ret) {
+        co_return unexpected(ret.error());
+    }
+
+    Result           result;
+    std::string      buffer(65536, '\0');
+    std::vector<int> open = {process.m_stdout, process.m_stderr};
+    for (int fd : open) {
+        attach(fd);
+    }
+    while (!open.empty()) {
+        int  fd        = co_await readable(open);
+        auto bytesRead = ::read(fd, buffer.data(), buffer.size());
+        if (bytesRead > 0) {
+            (fd == process.m_stdout ? result.out : result.err).append(buffer.data(), size_t(bytesRead));
+        } else if (bytesRead == 0 || (errno != EINTR && errno != EAGAIN)) {
+            detach(fd);
+            open.erase(std::find(open.begin(), open.end(), fd));
+        }
+    }
+
+    auto code = co_await exited(process);
+    if (!code) {
+        co_return unexpected(code.error());
+    }
+    result.exitCode = *code;
+    co_return std::move(result);
+}
+
+inline void ProcessReactor::spawn(Task<void>&& task)
+{
+    m_tasks.push_back(std::move(task));
+    m_tasks.back().m_handle.resume();
+}
+
+inline void ProcessReactor::run()
+{
+    while (true) {
+        m_tasks.erase(std::remove_if(m_tasks.begin(), m_tasks.end(), [](const Task<void>& task) {
+            return task.done();
+        }), m_tasks.end());
+
+        if (m_tasks.empty() || !waiting()) {
+            break;
+        }
+        poll();
+    }
+}
+
+template <typename T>
+T ProcessReactor::run(Task<T>&& task)
+{
+    task.m_handle.resume();
+    while (!task.done() && waiting()) {
+        poll();
+    }
+    assert(task.done() && "task waits for something else than the reactor");
+    return task.m_handle.promise().take();
+}
+
+inline void ProcessReactor::poll()
+{
+    std::array<epoll_event, 64> events;
+
+    int count = epoll_wait(m_epoll, events.data(), int(events.size()), -1);
+    if (count == -1) {
+        return;
+    }
+
+    std::vector<std::coroutine_handle<>> ready;
+    for (int i = 0; i < count; ++i) {
+        int  fd = events[size_t(i)].data.fd;
+        auto it = m_watches.find(fd);
+        if (it == m_watches.end()) {
+            continue;
+        }
+
+        // Waiter might be resumed by its other descriptor in this round already
+        if (Readable* waiter = it->second.waiter) {
+            waiter->m_ready = fd;
+            unwatch(*waiter);
+            ready.push_back(waiter->m_handle);
+        } else if (it->second.armed) {
+            // Level triggered, it would wake up every round until somebody reads it
+            epoll_event ev = {};
+            ev.data.fd     = fd;
+            epoll_ctl(m_epoll, EPOLL_CTL_MOD, fd, &ev);
+            it->second.armed = false;
+        }
+    }
+
+    for (auto& handle : ready) {
+        handle.resume();
+    }
+}
+
+inline bool ProcessReactor::watch(Readable& waiter)
+{
+    for (int fd : waiter.m_fds) {
+        auto& watch = m_watches[fd];
+
+        epoll_event ev = {};
+        ev.events      = EPOLLIN;
+        ev.data.fd     = fd;
+        if (!watch.persistent) {
+            if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) == -1) {
+                // Not pollable (or error), let the caller find out by reading it
+                m_watches.erase(fd);
+                unwatch(waiter);
+                waiter.m_ready = fd;
+                return false;
+            }
+        } else if (!watch.armed) {
+            epoll_ctl(m_epoll, EPOLL_CTL_MOD, fd, &ev);
+        }
+        watch.armed  = true;
+        watch.waiter = &waiter;
+    }
+    return true;
+}
+
+inline void ProcessReactor::unwatch(Readable& waiter)
+{
+    for (int fd : waiter.m_fds) {
+        auto it = m_watches.find(fd);
+        if (it == m_watches.end() || it->second.waiter != &waiter) {
+            continue;
+        }
+        if (it->second.persistent) {
+            it->second.waiter = nullptr;
+        } else {
+            epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+            m_watches.erase(it);
+        }
+    }
+}
+
+inline void ProcessReactor::attach(int fd)
+{
+    auto& watch = m_watches[fd];
+    if (watch.persistent) {
+        return;
+    }
+
+    epoll_event ev = {};
+    ev.events      = EPOLLIN;
+    ev.data.fd     = fd;
+    if (watch.waiter || epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) == 0) {
+        watch.persistent = true;
+        watch.armed      = true;
+    } else if (!watch.waiter) {
+        // Not pollable, watch() reports it when awaited
+        m_watches.erase(fd);
+    }
+}
+
+inline void ProcessReactor::detach(int fd)
+{
+    auto it = m_watches.find(fd);
+    if (it == m_watches.end() || !it->second.persistent) {
+        return;
+    }
+    if (it->second.waiter) {
+        // Unregistered by unwatch() once the waiter is resumed
+        it->second.persistent = false;
+        return;
+    }
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+    m_watches.erase(it);
+}
+
+inline bool ProcessReactor::waiting() const
+{
+    return std::any_of(m_watches.begin(), m_watches.end(), [](const auto& watch) {
+        return watch.second.waiter != nullptr;
+    });
+}
+
+// =========================================================================================================================================
+
+} // namespace fty
+
+#endif
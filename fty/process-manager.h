@@ -0,0 +1,472 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <fty/event.h>
+#include <fty/process.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <thread>
+
+namespace fty {
+
+// =========================================================================================================================================
+
+/// How a supervised child is stopped
+struct TerminationPolicy
+{
+    /// Graceful signal, sent first
+    int signal = SIGTERM;
+    /// Time given to the child to exit after the graceful signal, SIGKILL is sent then
+    std::chrono::milliseconds grace = std::chrono::seconds(5);
+    /// Signal the whole process group of the child. Child must lead its own group, see SpawnConfig::processGroup.
+    bool processGroup = false;
+};
+
+/// Supervises many child processes with one reaper thread.
+/// Every child is tracked by its process descriptor (pidfd) registered in epoll, so exit of one child never
+/// wakes up waiters of another one.
+class ProcessManager
+{
+public:
+    /// Handle of the supervised child
+    class Child
+    {
+    public:
+        /// Child exit code (or signal number), fired from the reaper thread once the child is finished, so
+        /// wait() can return before the slots are called
+        Event<int> finished;
+        /// Child was killed because of timeout, fired from the reaper thread
+        Event<> timedOut;
+
+    public:
+        pid_t pid() const;
+        bool  isFinished() const;
+
+        /// Waits for the child exit
+        /// @return exit code or error if the child was killed by timeout
+        Expected<int> wait(int milliseconds = -1);
+
+        /// Sends a signal to the child, safe until the child is reaped
+        bool kill(int signal = SIGKILL);
+
+    private:
+        friend class ProcessManager;
+        using Clock = std::chrono::steady_clock;
+
+        bool signal(int sig);
+
+        pid_t                   m_pid        = 0;
+        int                     m_pidfd      = -1;
+        int                     m_status     = 0;
+        bool                    m_finished   = false;
+        bool                    m_reaped     = false;
+        bool                    m_timedOut   = false;
+        bool                    m_stopping   = false;
+        Clock::time_point       m_deadline   = Clock::time_point::max();
+        Clock::time_point       m_escalation = Clock::time_point::max();
+        TerminationPolicy       m_policy     = {SIGKILL, std::chrono::milliseconds(0), false};
+        mutable std::mutex      m_mutex;
+        std::condition_variable m_cv;
+    };
+
+    using ChildPtr = std::shared_ptr<Child>;
+
+public:
+    /// Any supervised child exited (pid, exit code), fired from the reaper thread once the child is finished,
+    /// before Child::finished.
+    /// Unlike Child::finished it can be connected before the child is added, so no exit is missed.
+    Event<pid_t, int> finished;
+
+public:
+    ProcessManager();
+    ~ProcessManager();
+
+    ProcessManager(const ProcessManager&) = delete;
+    ProcessManager& operator=(const ProcessManager&) = delete;
+
+    /// Takes over the running process. Process is not reaped by Process::wait() anymore, but its pipes stay
+    /// usable.
+    /// @param process running process
+    /// @param milliseconds kill child after the timeout, -1 for no timeout
+    Expected<ChildPtr> watch(Process& process, int milliseconds = -1);
+
+    /// Supervises the child by pid, child must be a child of current process.
+    /// @param pid child pid
+    /// @param milliseconds kill child after the timeout, -1 for no timeout
+    Expected<ChildPtr> watch(pid_t pid, int milliseconds = -1);
+
+    /// Takes over the running process, stops it with the policy after the timeout
+    /// @param process running process
+    /// @param milliseconds timeout, -1 for no timeout
+    /// @param policy how the child is stopped on timeout
+    Expected<ChildPtr> watch(Process& process, int milliseconds, const TerminationPolicy& policy);
+
+    /// Stops the child without blocking: sends the graceful signal now, SIGKILL from the reaper thread if the
+    /// child is still running after the grace period. Use Child::wait() to wait for the exit.
+    void terminate(const ChildPtr& child, const TerminationPolicy& policy = {});
+
+    /// Takes over the running process and stops it, see terminate(const ChildPtr&, ...)
+    Expected<ChildPtr> terminate(Process& process, const TerminationPolicy& policy = {});
+
+    /// Returns number of children which are not reaped yet
+    size_t count() const;
+
+    /// Process wide manager
+    static ProcessManager& instance();
+
+private:
+    void worker();
+    void wakeUp();
+    void reap(const ChildPtr& child);
+    void timeout(const ChildPtr& child);
+    void escalate(const ChildPtr& child);
+    int  nextTimeout() const;
+
+private:
+    int                     m_epoll = -1;
+    int                     m_wake  = -1;
+    std::map<int, ChildPtr> m_children;
+    mutable std::mutex      m_mutex;
+    std::atomic<bool>       m_running = true;
+    std::thread             m_thread;
+};
+
+// =========================================================================================================================================
+
+inline pid_t ProcessManager::Child::pid() const
+{
+    return m_pid;
+}
+
+inline bool ProcessManager::Child::isFinished() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_finished;
+}
+
+inline Expected<int> ProcessManager::Child::wait(int milliseconds)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto                         done = [&]() {
+        return m_finished;
+    };
+
+    if (milliseconds < 0) {
+        m_cv.wait(lock, done);
+    } else if (!m_cv.wait_for(lock, std::chrono::milliseconds(milliseconds), done)) {
+        return unexpected("timeout");
+    }
+
+    if (m_timedOut) {
+        return unexpected("killed by timeout");
+    }
+    return m_status;
+}
+
+inline bool ProcessManager::Child::kill(int sig)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_reaped) {
+        return false;
+    }
+    return ::kill(m_pid, sig) == 0;
+}
+
+inline bool ProcessManager::Child::signal(int sig)
+{
+    // Called with the mutex locked
+    if (m_reaped) {
+        return false;
+    }
+    return ::kill(m_policy.processGroup ? -m_pid : m_pid, sig) == 0;
+}
+
+// =========================================================================================================================================
+
+inline ProcessManager::ProcessManager()
+    : m_epoll(epoll_create1(EPOLL_CLOEXEC))
+    , m_wake(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+{
+    epoll_event ev = {};
+    ev.events      = EPOLLIN;
+    ev.data.fd     = m_wake;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wake, &ev);
+
+    m_thread = std::thread(&ProcessManager::worker, this);
+    pthread_setname_np(m_thread.native_handle(), "reaper");
+}
+
+inline ProcessManager::~ProcessManager()
+{
+    m_running = false;
+    wakeUp();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+
+    // Do not leave zombies behind
+    for (auto& [fd, child] : m_children) {
+        ::kill(child->m_pid, SIGKILL);
+        int status;
+        waitpid(child->m_pid, &status, 0);
+        close(fd);
+    }
+
+    close(m_wake);
+    close(m_epoll);
+}
+
+inline Expected<ProcessManager::ChildPtr> ProcessManager::watch(Process& process, int milliseconds)
+{
+    if (!process.m_pid) {
+        return unexpected("process is not running");
+    }
+
+    auto child = watch(process.m_pid, milliseconds);
+    if (child) {
+        process.m_pid = 0;
+    }
+    return child;
+}
+
+inline Expected<ProcessManager::ChildPtr> ProcessManager::watch(pid_t pid, int milliseconds)
+{
+    int pidfd = details::pidfdOpen(pid);
+    if (pidfd == -1) {
+        return unexpected("pidfd_open failed: {}", strerror(errno));
+    }
+
+    auto child     = std::make_shared<Child>();
+    child->m_pid   = pid;
+    child->m_pidfd = pidfd;
+    if (milliseconds >= 0) {
+        child->m_deadline = Child::Clock::now() + std::chrono::milliseconds(milliseconds);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_children.emplace(pidfd, child);
+
+        epoll_event ev = {};
+        ev.events      = EPOLLIN;
+        ev.data.fd     = pidfd;
+        if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, pidfd, &ev) == -1) {
+            m_children.erase(pidfd);
+            close(pidfd);
+            return unexpected("epoll_ctl failed: {}", strerror(errno));
+        }
+    }
+
+    // Recalculate timeout
+    if (milliseconds >= 0) {
+        wakeUp();
+    }
+    return child;
+}
+
+inline Expected<ProcessManager::ChildPtr> ProcessManager::watch(Process& process, int milliseconds, const TerminationPolicy& policy)
+{
+    auto child = watch(process, -1);
+    if (!child) {
+        return child;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::lock_guard<std::mutex> childLock((*child)->m_mutex);
+        (*child)->m_policy = policy;
+        if (milliseconds >= 0) {
+            (*child)->m_deadline = Child::Clock::now() + std::chrono::milliseconds(milliseconds);
+        }
+    }
+    wakeUp();
+    return child;
+}
+
+inline void ProcessManager::terminate(const ChildPtr& child, const TerminationPolicy& policy)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::lock_guard<std::mutex> childLock(child->m_mutex);
+        if (child->m_reaped) {
+            return;
+        }
+        child->m_policy   = policy;
+        child->m_stopping = true;
+        child->signal(policy.signal);
+        child->m_escalation = std::min(child->m_escalation, Child::Clock::now() + policy.grace);
+    }
+    wakeUp();
+}
+
+inline Expected<ProcessManager::ChildPtr> ProcessManager::terminate(Process& process, const TerminationPolicy& policy)
+{
+    auto child = watch(process);
+    if (child) {
+        terminate(*child, policy);
+    }
+    return child;
+}
+
+inline size_t ProcessManager::count() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_children.size();
+}
+
+inline ProcessManager& ProcessManager::instance()
+{
+    static ProcessManager manager;
+    return manager;
+}
+
+inline void ProcessManager::worker()
+{
+    std::array<epoll_event, 64> events;
+
+    while (m_running) {
+        int count = epoll_wait(m_epoll, events.data(), int(events.size()), nextTimeout());
+        if (count == -1 && errno != EINTR) {
+            break;
+        }
+
+        std::vector<ChildPtr> exited;
+        std::vector<ChildPtr> expired;
+        std::vector<ChildPtr> escalated;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (int i = 0; i < count; ++i) {
+                int fd = events[size_t(i)].data.fd;
+                if (fd == m_wake) {
+                    eventfd_t val;
+                    eventfd_read(m_wake, &val);
+                } else if (auto it = m_children.find(fd); it != m_children.end()) {
+                    epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+                    exited.push_back(it->second);
+                    m_children.erase(it);
+                }
+            }
+
+            auto now = Child::Clock::now();
+            for (const auto& [fd, child] : m_children) {
+                if (child->m_deadline <= now) {
+                    child->m_deadline = Child::Clock::time_point::max();
+                    expired.push_back(child);
+                }
+                if (child->m_escalation <= now) {
+                    child->m_escalation = Child::Clock::time_point::max();
+                    escalated.push_back(child);
+                }
+            }
+        }
+
+        for (const auto& child : expired) {
+            timeout(child);
+        }
+
+        for (const auto& child : escalated) {
+            escalate(child);
+        }
+
+        for (const auto& child : exited) {
+            reap(child);
+        }
+    }
+}
+
+inline void ProcessManager::wakeUp()
+{
+    eventfd_write(m_wake, 1);
+}
+
+inline void ProcessManager::reap(const ChildPtr& child)
+{
+    int status = 0;
+    {
+        std::lock_guard<std::mutex> lock(child->m_mutex);
+        // Group leader is a zombie until it is reaped, so the group id is still ours: do not leave the rest
+        // of a group being terminated behind
+        if (child->m_policy.processGroup && child->m_stopping) {
+            ::kill(-child->m_pid, SIGKILL);
+        }
+        while (waitpid(child->m_pid, &status, 0) == -1 && errno == EINTR) {
+        }
+        close(child->m_pidfd);
+        child->m_reaped   = true;
+        child->m_status   = details::exitStatus(status);
+        child->m_finished = true;
+        child->m_pidfd    = -1;
+    }
+    child->m_cv.notify_all();
+
+    // State is final before the slots run, they can wait for the child without blocking the reaper
+    int code = details::exitStatus(status);
+    finished(pid_t(child->m_pid), int(code));
+    child->finished(int(code));
+}
+
+inline void ProcessManager::timeout(const ChildPtr& child)
+{
+    std::chrono::milliseconds grace;
+    {
+        std::lock_guard<std::mutex> lock(child->m_mutex);
+        if (child->m_finished || child->m_timedOut) {
+            return;
+        }
+        child->m_timedOut = true;
+        child->m_stopping = true;
+        child->signal(child->m_policy.signal);
+        grace = child->m_policy.signal != SIGKILL ? child->m_policy.grace : std::chrono::milliseconds(-1);
+    }
+
+    if (grace.count() >= 0) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        child->m_escalation = Child::Clock::now() + grace;
+    }
+    child->timedOut();
+}
+
+inline void ProcessManager::escalate(const ChildPtr& child)
+{
+    std::lock_guard<std::mutex> lock(child->m_mutex);
+    child->signal(SIGKILL);
+}
+
+inline int ProcessManager::nextTimeout() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto next = Child::Clock::time_point::max();
+    for (const auto& [fd, child] : m_children) {
+        next = std::min({next, child->m_deadline, child->m_escalation});
+    }
+
+    if (next == Child::Clock::time_point::max()) {
+        return -1;
+    }
+
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(next - Child::Clock::now()).count();
+    return left > 0 ? int(left) + 1 : 0;
+}
+
+// =========================================================================================================================================
+
+} // namespace fty
@@ -1,16 +1,51 @@
 #pragma once
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <dirent.h>
 #include <fcntl.h>
+#include <fty/event.h>
 #include <fty/expected.h>
 #include <fty/flags.h>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <poll.h>
 #include <spawn.h>
+#include <string_view>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <utility>
 #include <vector>
 #include <wait.h>
 
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
 namespace fty {
 
+class ProcessManager;
+class CoprocessPool;
+class ProcessBatch;
+class ProcessReactor;
+class CaptureEngine;
+class Process;
+
+namespace details {
+    Expected<void> waitReadable(
+        int fd, const std::chrono::steady_clock::time_point& deadline, int milliseconds, Process* input = nullptr);
+}
+
 // =========================================================================================================================================
 
 enum class Capture
@@ -22,6 +57,85 @@ enum class Capture
 };
 ENABLE_FLAGS(Capture)
 
+/// Child spawn settings
+struct SpawnConfig
+{
+    /// Spawn with vfork semantics (parent memory is not duplicated). Modern glibc always does it.
+    bool useVfork = true;
+    /// Close all the descriptors except standard input, output and error in the child
+    bool closeOtherFds = true;
+    /// Signal mask of the child, parent's mask if not set
+    std::optional<sigset_t> signalMask;
+    /// Signals reset to the default action in the child, ignored signals stay ignored if not set
+    std::optional<sigset_t> defaultSignals;
+    /// Process group of the child, 0 creates new group with child pid as its id
+    std::optional<pid_t> processGroup;
+};
+
+/// Resources used by the reaped child
+struct ResourceUsage
+{
+    /// Time from the spawn to the reap
+    std::chrono::microseconds wallTime{0};
+    /// CPU time spent in user mode
+    std::chrono::microseconds userTime{0};
+    /// CPU time spent in kernel mode
+    std::chrono::microseconds systemTime{0};
+    /// Maximum resident set size, in kilobytes
+    long maxRss = 0;
+    /// Context switches because the child waited for a resource
+    long voluntarySwitches = 0;
+    /// Context switches because the child was preempted
+    long involuntarySwitches = 0;
+};
+
+/// Captured output, kept in memory or, when large, in a memory mapped read-only spill file
+class CapturedOutput
+{
+public:
+    CapturedOutput() = default;
+    explicit CapturedOutput(std::string&& data);
+    CapturedOutput(CapturedOutput&& other) noexcept;
+    CapturedOutput& operator=(CapturedOutput&& other) noexcept;
+    ~CapturedOutput();
+
+    CapturedOutput(const CapturedOutput&) = delete;
+    CapturedOutput& operator=(const CapturedOutput&) = delete;
+
+    /// Returns the data, valid while this object lives
+    std::string_view view() const;
+    /// Returns size of the data
+    size_t size() const;
+    /// Returns true if the data is in the spill file
+    bool isMapped() const;
+
+    /// Maps first `size` bytes of the file read-only, file descriptor can be closed afterwards
+    static Expected<CapturedOutput> map(int fd, size_t size);
+
+private:
+    std::string m_data;
+    const char* m_map  = nullptr;
+    size_t      m_size = 0;
+};
+
+/// Immutable snapshot of environment variables ("NAME=value" entries), shared between processes
+class Environment
+{
+public:
+    using Ptr = std::shared_ptr<const Environment>;
+
+    Environment(std::vector<std::string>&& entries);
+
+    /// Returns snapshot of the current process environment. Snapshot is built once and rebuilt only if
+    /// the environment was changed since (checked without allocations).
+    static Ptr current();
+
+    const std::vector<std::string>& entries() const;
+
+private:
+    std::vector<std::string> m_entries;
+};
+
 class Process
 {
 public:
@@ -29,130 +143,517 @@ public:
     Process(const std::string& cmd, const Arguments& args = {}, Capture capture = Capture::Out | Capture::Err | Capture::In);
     ~Process();
 
+    /// Moves the child and its pipes, moved from process is not running
+    Process(Process&& other) noexcept;
+    Process& operator=(Process&& other) noexcept;
+    Process(const Process&) = delete;
+    Process& operator=(const Process&) = delete;
+
     Expected<pid_t> run();
-    Expected<int>   wait(int milliseconds = -1);
+    /// Writes queued input and closes standard input, then waits for the child. Failure to write the input is
+    /// returned, timeout covers both.
+    Expected<int> wait(int milliseconds = -1);
+    /// Waits for the child as wait(), and fills resources used by it
+    Expected<int> wait(ResourceUsage& usage, int milliseconds = -1);
 
     std::string readAllStandardError(int milliseconds = -1);
     std::string readAllStandardOutput(int milliseconds = -1);
+
+    /// Reads standard output until the child closes it, output buffer can be reused between calls
+    Expected<size_t> readAllStandardOutput(std::string& output, int milliseconds = -1);
+    /// Reads standard error until the child closes it, output buffer can be reused between calls
+    Expected<size_t> readAllStandardError(std::string& output, int milliseconds = -1);
+    /// Moves standard output to the descriptor until the child closes it, without copying it
+    Expected<size_t> spliceStandardOutput(int fd, int milliseconds = -1);
+    /// Reads standard output until the child closes it. Output bigger than the threshold is spilled to an
+    /// anonymous file and returned memory mapped, so it is never held on the heap.
+    Expected<CapturedOutput> captureStandardOutput(size_t threshold = 16 * 1024 * 1024, int milliseconds = -1);
+
+    /// Drains captured standard output and error together until the child closes both of them.
+    /// Neither stream can stall the child while the other one is read.
+    /// @param out standard output, appended
+    /// @param err standard error, appended
+    /// @param milliseconds overall timeout, -1 to wait forever
+    Expected<void> readAll(std::string& out, std::string& err, int milliseconds = -1);
+
+    /// Reads captured standard output and error as they arrive and fires data and line events, until the
+    /// child closes both streams. Memory use is bounded by the read buffer and the longest line.
+    /// @param milliseconds overall timeout, -1 to wait forever
+    Expected<void> stream(int milliseconds = -1);
+
     bool        write(const std::string& cmd);
+    /// Closes standard input, once queued input is written
     void        closeWriteChannel();
     void        setEnvVar(const std::string& name, const std::string& val);
     void        addArgument(const std::string& arg);
 
+    /// Queues data for the child standard input and writes what the pipe takes without blocking. Queued
+    /// input is also written while readAll() or stream() wait for the output.
+    /// Waits for the pipe only if the queue would exceed its capacity (backpressure).
+    /// @param milliseconds maximum time to wait for room in the queue, -1 to wait forever
+    Expected<void> writeAsync(std::string data, int milliseconds = -1);
+    /// Writes queued input, blocks until the queue is empty
+    Expected<void> flush(int milliseconds = -1);
+    /// Returns number of queued input bytes
+    size_t pendingInput() const;
+    /// Sets capacity of the input queue, 1Mb by default
+    void setInputBufferSize(size_t bytes);
+
+    /// Replaces base environment of the child, variables set by setEnvVar() are applied over it
+    void setEnvironment(const Environment::Ptr& environment);
+
+    /// Sets spawn settings. Set before run().
+    void setSpawnConfig(const SpawnConfig& config);
+
+    /// Connects child standard input to the descriptor, used if input is not captured. Set before run().
+    void setStandardInput(int fd);
+    /// Connects child standard output to the descriptor, used if output is not captured. Set before run().
+    void setStandardOutput(int fd);
+
+    /// Sends SIGINT and waits for the child, blocks until it exits. See ProcessManager::terminate().
     void interrupt();
+    /// Sends SIGKILL and waits for the child
     void kill();
 
     bool exists();
 
 public:
+    /// Chunk of standard output, fired from stream()
+    Event<std::string_view>& outputData();
+    /// Chunk of standard error, fired from stream()
+    Event<std::string_view>& errorData();
+    /// Line of standard output without line feed, fired from stream()
+    Event<std::string_view>& outputLine();
+    /// Line of standard error without line feed, fired from stream()
+    Event<std::string_view>& errorLine();
+
+public:
+    /// Runs the command and reads its output until it exits, descendants left in background do not block it
     static Expected<int> run(const std::string& cmd, const Arguments& args, std::string& out, std::string& err);
     static Expected<int> run(const std::string& cmd, const Arguments& args, std::string& out);
     static Expected<int> run(const std::string& cmd, const Arguments& args);
 
 private:
-    std::string              m_cmd;
-    std::vector<std::string> m_args;
-    std::vector<std::string> m_environ;
-    Capture                  m_capture;
-    pid_t                    m_pid    = 0;
-    int                      m_stdout = 0;
-    int                      m_stderr = 0;
-    int                      m_stdin  = 0;
+    friend class ProcessManager;
+    friend class CoprocessPool;
+    friend class ProcessBatch;
+    friend class ProcessReactor;
+    friend class CaptureEngine;
+    friend Expected<void> details::waitReadable(int, const std::chrono::steady_clock::time_point&, int, Process*);
+
+    Expected<int> waitChild(int milliseconds, rusage* usage);
+
+    /// Writes queued input with one writev without blocking
+    Expected<void> flushInput();
+    /// Writes queued input until at most `target` bytes are left
+    Expected<void> flushInputTo(size_t target, int milliseconds);
+    /// Reads fd while queued input is written, until the queue is empty or nothing happens for `milliseconds`
+    std::string readWhileWriting(int fd, int milliseconds);
+
+    /// Reads the outputs until they are closed. With untilExit, stops also once the child has exited and
+    /// the outputs stay empty for one poll cycle: its background descendants can keep them open forever.
+    template <typename Func>
+    Expected<void> drain(int milliseconds, bool untilExit, Func&& onData);
+    /// Checks if the child has exited, without reaping it
+    bool hasExited() const;
+
+    void swap(Process& other) noexcept;
+
+    /// Events of stream(), most processes are never streamed and do not pay for them
+    struct Streams
+    {
+        Event<std::string_view> outputData;
+        Event<std::string_view> errorData;
+        Event<std::string_view> outputLine;
+        Event<std::string_view> errorLine;
+    };
+    Streams& streams();
+
+    std::string                           m_cmd;
+    std::vector<std::string>              m_args;
+    Environment::Ptr                      m_environment;
+    std::vector<std::string>              m_envOverlay;
+    Capture                               m_capture = Capture::None;
+    SpawnConfig                           m_spawnConfig;
+    pid_t                                 m_pid    = 0;
+    std::chrono::steady_clock::time_point m_started;
+    int                                   m_stdout = 0;
+    int                                   m_stderr = 0;
+    int                                   m_stdin  = 0;
+    int                                   m_inFd   = -1;
+    int                                   m_outFd  = -1;
+    std::deque<std::string>               m_input;
+    size_t                                m_inputOffset   = 0;
+    size_t                                m_inputPending  = 0;
+    size_t                                m_inputCapacity = 1024 * 1024;
+    bool                                  m_closeInput    = false;
+    std::unique_ptr<Streams>              m_streams;
 };
 
 // =========================================================================================================================================
 
-class CharArray
-{
-public:
-    template <typename... Args>
-    CharArray(const Args&... args)
+namespace details {
+
+    inline int pidfdOpen(pid_t pid)
     {
-        add(args...);
-        m_data.push_back(nullptr);
+        return int(syscall(SYS_pidfd_open, pid, 0));
     }
 
-    CharArray(const CharArray&) = delete;
-
-    ~CharArray()
+    /// Converts waitpid status to the process exit code or signal number
+    inline int exitStatus(int status)
     {
-        for (size_t i = 0; i < m_data.size(); i++) {
-            delete[] m_data[i];
+        if (WIFEXITED(status)) {
+            return WEXITSTATUS(status);
+        } else if (WIFSIGNALED(status)) {
+            return WTERMSIG(status);
+        } else if (WIFSTOPPED(status)) {
+            return WSTOPSIG(status);
         }
+        return status;
     }
 
-    template <typename... Args>
-    void add(const std::string& arg, const Args&... args)
+    /// Adds actions closing every descriptor above standard error in the child. Without closefrom support
+    /// in posix_spawn (glibc < 2.34) the descriptors open in the parent are listed and closed one by one,
+    /// the ones opened meanwhile by other threads are not covered.
+    inline Expected<void> addCloseOtherFds(posix_spawn_file_actions_t& action)
     {
-        add(arg);
-        add(args...);
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 34)
+        if (int error = posix_spawn_file_actions_addclosefrom_np(&action, STDERR_FILENO + 1)) {
+            return unexpected("posix_spawn_file_actions_addclosefrom_np failed: {}", strerror(error));
+        }
+#else
+        DIR* dir = opendir("/proc/self/fd");
+        if (!dir) {
+            return unexpected("cannot list open descriptors: {}", strerror(errno));
+        }
+        while (dirent* entry = readdir(dir)) {
+            int fd = atoi(entry->d_name);
+            if (fd > STDERR_FILENO && fd != dirfd(dir)) {
+                if (int error = posix_spawn_file_actions_addclose(&action, fd)) {
+                    closedir(dir);
+                    return unexpected("posix_spawn_file_actions_addclose failed: {}", strerror(error));
+                }
+            }
+        }
+        closedir(dir);
+#endif
+        return {};
     }
 
-    void add(const std::string& str)
+} // namespace details
+
+namespace details {
+
+    /// Builds argv and envp arrays with all the strings in one allocation
+    class SpawnArena
     {
-        char* s = new char[str.size() + 1];
-        memset(s, 0, str.size() + 1);
-        strncpy(s, str.c_str(), str.size());
-        m_data.push_back(s);
+    public:
+        SpawnArena(const std::string& cmd, const std::vector<std::string>& args, const Environment& env,
+            const std::vector<std::string>& overlay)
+        {
+            size_t pointers = args.size() + 2 + overlay.size() + 1;
+            size_t bytes    = cmd.size() + 1;
+            for (const auto& arg : args) {
+                bytes += arg.size() + 1;
+            }
+            for (const auto& var : overlay) {
+                bytes += var.size() + 1;
+            }
+            for (const auto& var : env.entries()) {
+                if (!isOverridden(var, overlay)) {
+                    bytes += var.size() + 1;
+                    ++pointers;
+                }
+            }
+
+            m_data.reset(new char*[pointers + (bytes + sizeof(char*) - 1) / sizeof(char*)]);
+            char** ptr = m_data.get();
+            char*  str = reinterpret_cast<char*>(m_data.get() + pointers);
+
+            auto put = [&](const std::string& value) {
+                memcpy(str, value.c_str(), value.size() + 1);
+                *ptr++ = str;
+                str += value.size() + 1;
+            };
+
+            m_argv = ptr;
+            put(cmd);
+            for (const auto& arg : args) {
+                put(arg);
+            }
+            *ptr++ = nullptr;
+
+            m_envp = ptr;
+            for (const auto& var : env.entries()) {
+                if (!isOverridden(var, overlay)) {
+                    put(var);
+                }
+            }
+            for (const auto& var : overlay) {
+                put(var);
+            }
+            *ptr++ = nullptr;
+        }
+
+        char** argv()
+        {
+            return m_argv;
+        }
+
+        char** envp()
+        {
+            return m_envp;
+        }
+
+    private:
+        static bool isOverridden(const std::string& var, const std::vector<std::string>& overlay)
+        {
+            size_t nameLen = var.find('=');
+            for (const auto& over : overlay) {
+                if (over.size() > nameLen && over[nameLen] == '=' && over.compare(0, nameLen, var, 0, nameLen) == 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        std::unique_ptr<char*[]> m_data;
+        char**                   m_argv = nullptr;
+        char**                   m_envp = nullptr;
+    };
+
+} // namespace details
+
+inline Environment::Environment(std::vector<std::string>&& entries)
+    : m_entries(std::move(entries))
+{
+}
+
+inline Environment::Ptr Environment::current()
+{
+    static std::mutex         mutex;
+    static Ptr                cached;
+    static std::vector<char*> source;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // setenv/putenv replace the entry pointers, comparing pointers is enough to detect a change
+    bool   changed = !cached;
+    size_t count   = 0;
+    for (; environ[count]; ++count) {
+        changed = changed || count >= source.size() || source[count] != environ[count];
     }
+    changed = changed || count != source.size();
 
-    void add(const std::vector<std::string>& vec)
-    {
-        for (const std::string& str : vec) {
-            add(str);
+    if (changed) {
+        source.assign(environ, environ + count);
+
+        std::vector<std::string> entries;
+        entries.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            entries.emplace_back(environ[i]);
         }
+        cached = std::make_shared<Environment>(std::move(entries));
     }
+    return cached;
+}
 
-    char** data()
-    {
-        return m_data.data();
+inline const std::vector<std::string>& Environment::entries() const
+{
+    return m_entries;
+}
+
+inline CapturedOutput::CapturedOutput(std::string&& data)
+    : m_data(std::move(data))
+{
+}
+
+inline CapturedOutput::CapturedOutput(CapturedOutput&& other) noexcept
+    : m_data(std::move(other.m_data))
+    , m_map(std::exchange(other.m_map, nullptr))
+    , m_size(std::exchange(other.m_size, 0))
+{
+}
+
+inline CapturedOutput& CapturedOutput::operator=(CapturedOutput&& other) noexcept
+{
+    if (this != &other) {
+        if (m_map) {
+            munmap(const_cast<char*>(m_map), m_size);
+        }
+        m_data = std::move(other.m_data);
+        m_map  = std::exchange(other.m_map, nullptr);
+        m_size = std::exchange(other.m_size, 0);
     }
+    return *this;
+}
 
-private:
-    std::vector<char*> m_data;
-};
+inline CapturedOutput::~CapturedOutput()
+{
+    if (m_map) {
+        munmap(const_cast<char*>(m_map), m_size);
+    }
+}
+
+inline std::string_view CapturedOutput::view() const
+{
+    return m_map ? std::string_view(m_map, m_size) : std::string_view(m_data);
+}
+
+inline size_t CapturedOutput::size() const
+{
+    return m_map ? m_size : m_data.size();
+}
+
+inline bool CapturedOutput::isMapped() const
+{
+    return m_map != nullptr;
+}
+
+inline Expected<CapturedOutput> CapturedOutput::map(int fd, size_t size)
+{
+    CapturedOutput output;
+    if (!size) {
+        return output;
+    }
+
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        return unexpected("mmap failed: {}", strerror(errno));
+    }
+    madvise(addr, size, MADV_SEQUENTIAL);
+
+    output.m_map  = static_cast<const char*>(addr);
+    output.m_size = size;
+    return output;
+}
 
 inline Process::Process(const std::string& cmd, const Arguments& args, Capture capture)
     : m_cmd(cmd)
     , m_args(args)
+    , m_environment(Environment::current())
     , m_capture(capture)
 {
-    for (int i = 0; environ[i]; ++i) {
-        m_environ.push_back(environ[i]);
+}
+
+inline Process::Process(Process&& other) noexcept
+{
+    swap(other);
+}
+
+inline Process& Process::operator=(Process&& other) noexcept
+{
+    // Own child and pipes are released by the temporary
+    Process(std::move(other)).swap(*this);
+    return *this;
+}
+
+inline void Process::swap(Process& other) noexcept
+{
+    std::swap(m_cmd, other.m_cmd);
+    std::swap(m_args, other.m_args);
+    std::swap(m_environment, other.m_environment);
+    std::swap(m_envOverlay, other.m_envOverlay);
+    std::swap(m_capture, other.m_capture);
+    std::swap(m_spawnConfig, other.m_spawnConfig);
+    std::swap(m_pid, other.m_pid);
+    std::swap(m_started, other.m_started);
+    std::swap(m_stdout, other.m_stdout);
+    std::swap(m_stderr, other.m_stderr);
+    std::swap(m_stdin, other.m_stdin);
+    std::swap(m_inFd, other.m_inFd);
+    std::swap(m_outFd, other.m_outFd);
+    std::swap(m_input, other.m_input);
+    std::swap(m_inputOffset, other.m_inputOffset);
+    std::swap(m_inputPending, other.m_inputPending);
+    std::swap(m_inputCapacity, other.m_inputCapacity);
+    std::swap(m_closeInput, other.m_closeInput);
+    std::swap(m_streams, other.m_streams);
+}
+
+inline Process::Streams& Process::streams()
+{
+    if (!m_streams) {
+        m_streams = std::make_unique<Streams>();
     }
+    return *m_streams;
+}
+
+inline Event<std::string_view>& Process::outputData()
+{
+    return streams().outputData;
+}
+
+inline Event<std::string_view>& Process::errorData()
+{
+    return streams().errorData;
+}
+
+inline Event<std::string_view>& Process::outputLine()
+{
+    return streams().outputLine;
+}
+
+inline Event<std::string_view>& Process::errorLine()
+{
+    return streams().errorLine;
 }
 
 inline Process::~Process()
 {
     if (m_stdin) {
+        // Child might not read anymore, do not block on queued input
+        m_input.clear();
+        m_inputPending = 0;
         closeWriteChannel();
     }
     if (m_pid) {
         kill();
         assert(true && "Process was running, killed...");
     }
+    if (m_stdout) {
+        close(m_stdout);
+    }
+    if (m_stderr) {
+        close(m_stderr);
+    }
 }
 
 inline Expected<pid_t> Process::run()
 {
-    int coutPipe[2];
-    int cerrPipe[2];
-    int cinPipe[2];
+    int coutPipe[2] = {-1, -1};
+    int cerrPipe[2] = {-1, -1};
+    int cinPipe[2]  = {-1, -1};
 
     posix_spawn_file_actions_t action;
     posix_spawn_file_actions_init(&action);
 
+    auto release = [&]() {
+        posix_spawn_file_actions_destroy(&action);
+        for (int* fds : {coutPipe, cerrPipe, cinPipe}) {
+            if (fds[0] != -1) {
+                close(fds[0]);
+                close(fds[1]);
+            }
+        }
+    };
+
     if (isSet(m_capture, Capture::Out)) {
-        if (pipe(coutPipe)) {
+        if (pipe2(coutPipe, O_CLOEXEC)) {
+            release();
             return unexpected("pipe returned an error");
         }
         posix_spawn_file_actions_addclose(&action, coutPipe[0]);
         posix_spawn_file_actions_adddup2(&action, coutPipe[1], STDOUT_FILENO);
         // posix_spawn_file_actions_addclose(&action, coutPipe[1]);
+    } else if (m_outFd != -1) {
+        posix_spawn_file_actions_adddup2(&action, m_outFd, STDOUT_FILENO);
     }
 
     if (isSet(m_capture, Capture::Err)) {
-        if (pipe(cerrPipe)) {
+        if (pipe2(cerrPipe, O_CLOEXEC)) {
+            release();
             return unexpected("pipe returned an error");
         }
         posix_spawn_file_actions_addclose(&action, cerrPipe[0]);
@@ -161,20 +662,56 @@ inline Expected<pid_t> Process::run()
     }
 
     if (isSet(m_capture, Capture::In)) {
-        if (pipe(cinPipe)) {
+        if (pipe2(cinPipe, O_CLOEXEC)) {
+            release();
             return unexpected("pipe returned an error");
         }
         posix_spawn_file_actions_addclose(&action, cinPipe[1]);
         posix_spawn_file_actions_adddup2(&action, cinPipe[0], STDIN_FILENO);
         // posix_spawn_file_actions_addclose(&action, cinPipe[1]);
+    } else if (m_inFd != -1) {
+        posix_spawn_file_actions_adddup2(&action, m_inFd, STDIN_FILENO);
+    }
+
+    if (m_spawnConfig.closeOtherFds) {
+        // After dup2 actions, so redirected descriptors are already in place
+        if (auto ret = details::addCloseOtherFds(action); !ret) {
+            release();
+            return unexpected(ret.error());
+        }
+    }
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+
+    short flags = 0;
+    if (m_spawnConfig.useVfork) {
+        flags |= POSIX_SPAWN_USEVFORK;
+    }
+    if (m_spawnConfig.signalMask) {
+        flags |= POSIX_SPAWN_SETSIGMASK;
+        posix_spawnattr_setsigmask(&attr, &*m_spawnConfig.signalMask);
+    }
+    if (m_spawnConfig.defaultSignals) {
+        flags |= POSIX_SPAWN_SETSIGDEF;
+        posix_spawnattr_setsigdefault(&attr, &*m_spawnConfig.defaultSignals);
+    }
+    if (m_spawnConfig.processGroup) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, *m_spawnConfig.processGroup);
     }
+    posix_spawnattr_setflags(&attr, flags);
 
+    details::SpawnArena arena(m_cmd, m_args, *m_environment, m_envOverlay);
 
-    CharArray args(m_cmd, m_args);
-    CharArray env(m_environ);
+    m_started = std::chrono::steady_clock::now();
+    int error = posix_spawnp(&m_pid, m_cmd.data(), &action, &attr, arena.argv(), arena.envp());
+    posix_spawnattr_destroy(&attr);
 
-    if (posix_spawnp(&m_pid, m_cmd.data(), &action, nullptr, args.data(), env.data()) != 0) {
-        return unexpected("posix_spawnp failed with error: {}", strerror(errno));
+    if (error != 0) {
+        release();
+        m_pid = 0;
+        return unexpected("posix_spawnp failed with error: {}", strerror(error));
     }
 
     if (posix_spawn_file_actions_destroy(&action)) {
@@ -194,6 +731,7 @@ inline Expected<pid_t> Process::run()
     if (isSet(m_capture, Capture::In)) {
         close(cinPipe[0]);
         m_stdin = cinPipe[1];
+        fcntl(m_stdin, F_SETFL, fcntl(m_stdin, F_GETFL) | O_NONBLOCK);
     }
 
     return m_pid;
@@ -201,7 +739,41 @@ inline Expected<pid_t> Process::run()
 
 inline Expected<int> Process::wait(int milliseconds)
 {
+    return waitChild(milliseconds, nullptr);
+}
+
+inline Expected<int> Process::wait(ResourceUsage& usage, int milliseconds)
+{
+    rusage ru = {};
+    auto   ret = waitChild(milliseconds, &ru);
+    if (!ret) {
+        return ret;
+    }
+
+    auto toMicroseconds = [](const timeval& tv) {
+        return std::chrono::seconds(tv.tv_sec) + std::chrono::microseconds(tv.tv_usec);
+    };
+
+    usage.wallTime            = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_started);
+    usage.userTime            = toMicroseconds(ru.ru_utime);
+    usage.systemTime          = toMicroseconds(ru.ru_stime);
+    usage.maxRss              = ru.ru_maxrss;
+    usage.voluntarySwitches   = ru.ru_nvcsw;
+    usage.involuntarySwitches = ru.ru_nivcsw;
+    return ret;
+}
+
+inline Expected<int> Process::waitChild(int milliseconds, rusage* usage)
+{
+    auto start = std::chrono::steady_clock::now();
+    if (auto ret = flush(milliseconds); !ret) {
+        return unexpected(ret.error());
+    }
     closeWriteChannel();
+    if (!m_pid) {
+        return unexpected("process is not running");
+    }
+
     int status = 0;
     if (milliseconds >= 0) {
         sigset_t childMask, oldMask;
@@ -212,9 +784,13 @@ inline Expected<int> Process::wait(int milliseconds)
             return unexpected("sigprocmask failed: {}", strerror(errno));
         }
 
+        // Time spent on queued input is part of the timeout
+        auto spent = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        int  left  = std::max(0, milliseconds - int(spent.count()));
+
         timespec ts;
-        ts.tv_sec  = milliseconds / 1000;
-        ts.tv_nsec = (milliseconds % 1000) * 1000000;
+        ts.tv_sec  = left / 1000;
+        ts.tv_nsec = (left % 1000) * 1000000;
 
         int res;
         do {
@@ -231,7 +807,7 @@ inline Expected<int> Process::wait(int milliseconds)
             return unexpected("sigprocmask failed: {}", strerror(errno));
         }
 
-        pid_t childPid = waitpid(m_pid, &status, WNOHANG);
+        pid_t childPid = wait4(m_pid, &status, WNOHANG, usage);
         if (childPid != m_pid) {
             if (childPid != -1) {
                 return unexpected("Waiting for pid {}, got pid {} instead\n", m_pid, childPid);
@@ -244,7 +820,7 @@ inline Expected<int> Process::wait(int milliseconds)
     }
 
     do {
-        if (auto res = waitpid(m_pid, &status, WUNTRACED | WCONTINUED); res == -1) {
+        if (auto res = wait4(m_pid, &status, WUNTRACED | WCONTINUED, usage); res == -1) {
             return unexpected("waitpid");
         }
 
@@ -289,7 +865,7 @@ inline std::string readFromFd(int fd, int milliseconds, int maxretry = 2)
         if (int retval = select(fd+1, &readSet, nullptr, nullptr, &tv); retval > 0) {
             if (FD_ISSET(fd, &readSet)) {
                 if (auto bytesRead = read(fd, &buffer[0], buffer.size()); bytesRead > 0) {
-                    output += std::string(buffer.data(), size_t(bytesRead));
+                    output.append(buffer.data(), size_t(bytesRead));
                 } else {
                     if ((errno == EAGAIN || errno == EWOULDBLOCK) && exit < maxretry) {
                         ++exit;
@@ -309,38 +885,644 @@ inline std::string readFromFd(int fd, int milliseconds, int maxretry = 2)
     return output;
 }
 
+namespace details {
+
+    /// Waits until fd is readable or deadline is reached. Queued standard input of the input process is
+    /// written meanwhile, a child blocked on its input would never produce the awaited output.
+    inline Expected<void> waitReadable(
+        int fd, const std::chrono::steady_clock::time_point& deadline, int milliseconds, Process* input)
+    {
+        std::array<pollfd, 2> fds = {{{fd, POLLIN, 0}, {-1, POLLOUT, 0}}};
+        while (true) {
+            int timeout = -1;
+            if (milliseconds >= 0) {
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                timeout   = std::max(0, int(left.count()));
+            }
+
+            bool writing = input && input->m_stdin && input->m_inputPending;
+            fds[1].fd    = writing ? input->m_stdin : -1;
+
+            int res = poll(fds.data(), writing ? 2 : 1, timeout);
+            if (res == -1 && errno == EINTR) {
+                continue;
+            } else if (res == 0) {
+                return unexpected("timeout");
+            } else if (res == -1) {
+                return unexpected("poll failed: {}", strerror(errno));
+            }
+
+            if (writing && fds[1].revents) {
+                // Write errors mean the child does not read anymore, its output is still awaited
+                input->flushInput();
+            }
+            if (fds[0].revents) {
+                return {};
+            }
+        }
+    }
+
+    /// Blocks SIGPIPE in the calling thread, so writing to a closed pipe fails with EPIPE instead of killing
+    /// the process. SIGPIPE raised by our own writes is consumed.
+    class SigPipeGuard
+    {
+    public:
+        SigPipeGuard()
+        {
+            sigemptyset(&m_mask);
+            sigaddset(&m_mask, SIGPIPE);
+            pthread_sigmask(SIG_BLOCK, &m_mask, &m_oldMask);
+
+            sigset_t pending;
+            sigpending(&pending);
+            m_wasPending = sigismember(&pending, SIGPIPE);
+        }
+
+        ~SigPipeGuard()
+        {
+            if (m_raised && !m_wasPending) {
+                timespec zero = {0, 0};
+                sigtimedwait(&m_mask, nullptr, &zero);
+            }
+            pthread_sigmask(SIG_SETMASK, &m_oldMask, nullptr);
+        }
+
+        /// Records failed write
+        void failed(int error)
+        {
+            m_raised = m_raised || error == EPIPE;
+        }
+
+    private:
+        sigset_t m_mask;
+        sigset_t m_oldMask;
+        bool     m_wasPending = false;
+        bool     m_raised     = false;
+    };
+
+    /// Writes all the data, retrying short writes and waiting if the descriptor is non-blocking, at most until
+    /// the deadline unless milliseconds is -1
+    inline Expected<void> writeAll(
+        int fd, std::string_view data, const std::chrono::steady_clock::time_point& deadline, int milliseconds)
+    {
+        SigPipeGuard guard;
+        while (!data.empty()) {
+            auto written = ::write(fd, data.data(), data.size());
+            if (written >= 0) {
+                data.remove_prefix(size_t(written));
+            } else if (errno == EAGAIN) {
+                int timeout = -1;
+                if (milliseconds >= 0) {
+                    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                    timeout   = std::max(0, int(left.count()));
+                }
+
+                pollfd pfd = {fd, POLLOUT, 0};
+                if (poll(&pfd, 1, timeout) == 0) {
+                    return unexpected("timeout");
+                }
+            } else if (errno != EINTR) {
+                int error = errno;
+                guard.failed(error);
+                return unexpected("write failed: {}", strerror(error));
+            }
+        }
+        return {};
+    }
+
+    /// Writes all the data, retrying short writes and waiting if the descriptor is non-blocking
+    inline Expected<void> writeAll(int fd, std::string_view data)
+    {
+        return writeAll(fd, data, {}, -1);
+    }
+
+} // namespace details
+
+/// Reads from fd until end of file, directly into the output which can be reused between calls.
+/// Output grows geometrically and is presized with the amount of data pending in the pipe.
+/// @param fd descriptor to read
+/// @param output data is appended to it
+/// @param milliseconds overall timeout, -1 to wait forever
+/// @param input process whose queued standard input is written while waiting, see Process::writeAsync()
+/// @return number of read bytes
+inline Expected<size_t> readFromFd(int fd, std::string& output, int milliseconds = -1, Process* input = nullptr)
+{
+    static constexpr size_t chunkSize = 65536;
+
+    auto   deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+    size_t used     = output.size();
+    size_t total    = 0;
+
+    while (true) {
+        if (auto ret = details::waitReadable(fd, deadline, milliseconds, input); !ret) {
+            output.resize(used);
+            return unexpected(ret.error());
+        }
+
+        int pending = 0;
+        if (ioctl(fd, FIONREAD, &pending) == -1) {
+            pending = 0;
+        }
+
+        size_t need = used + std::max(size_t(pending), chunkSize);
+        if (output.size() < need) {
+            output.resize(std::max(need, output.size() * 2));
+        }
+
+        auto bytesRead = read(fd, &output[used], output.size() - used);
+        if (bytesRead > 0) {
+            used += size_t(bytesRead);
+            total += size_t(bytesRead);
+        } else if (bytesRead == 0) {
+            break;
+        } else if (errno != EINTR && errno != EAGAIN) {
+            output.resize(used);
+            return unexpected("read failed: {}", strerror(errno));
+        }
+    }
+
+    output.resize(used);
+    return total;
+}
+
+/// Moves everything from pipe fd to outFd until end of file without copying it through user space.
+/// Falls back to read/write if outFd does not support splice.
+/// @param fd pipe to read
+/// @param outFd descriptor to write (file, socket or pipe)
+/// @param milliseconds overall timeout, -1 to wait forever
+/// @param input process whose queued standard input is written while waiting, see Process::writeAsync()
+/// @return number of moved bytes
+inline Expected<size_t> spliceFromFd(int fd, int outFd, int milliseconds = -1, Process* input = nullptr)
+{
+    static constexpr size_t chunkSize = 1 << 20;
+
+    auto   deadline  = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+    size_t total     = 0;
+    bool   useSplice = true;
+
+    std::string buffer;
+    while (true) {
+        if (auto ret = details::waitReadable(fd, deadline, milliseconds, input); !ret) {
+            return unexpected(ret.error());
+        }
+
+        ssize_t moved;
+        if (useSplice) {
+            moved = splice(fd, nullptr, outFd, nullptr, chunkSize, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (moved == -1 && errno == EINVAL) {
+                useSplice = false;
+                continue;
+            }
+        } else {
+            buffer.resize(65536);
+            moved = read(fd, buffer.data(), buffer.size());
+            for (ssize_t written = 0; moved > 0 && written < moved;) {
+                auto ret = ::write(outFd, buffer.data() + written, size_t(moved - written));
+                if (ret == -1 && errno != EINTR) {
+                    return unexpected("write failed: {}", strerror(errno));
+                }
+                written += std::max(ret, ssize_t(0));
+            }
+        }
+
+        if (moved > 0) {
+            total += size_t(moved);
+        } else if (moved == 0) {
+            break;
+        } else if (errno != EINTR && errno != EAGAIN) {
+            return unexpected("splice failed: {}", strerror(errno));
+        }
+    }
+    return total;
+}
+
+/// Reads from fd until end of file. Keeps the data in memory up to the threshold, then moves it and the rest
+/// of the stream to an anonymous file (memfd, or unlinked temporary file) which is memory mapped at the end.
+/// @param fd descriptor to read
+/// @param threshold maximum size kept in memory
+/// @param milliseconds overall timeout, -1 to wait forever
+/// @param input process whose queued standard input is written while waiting, see Process::writeAsync()
+inline Expected<CapturedOutput> captureFromFd(
+    int fd, size_t threshold, int milliseconds = -1, Process* input = nullptr)
+{
+    static constexpr size_t chunkSize = 65536;
+
+    auto        deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+    std::string memory;
+
+    while (memory.size() <= threshold) {
+        if (auto ret = details::waitReadable(fd, deadline, milliseconds, input); !ret) {
+            return unexpected(ret.error());
+        }
+
+        size_t used = memory.size();
+        memory.resize(used + std::min(chunkSize, threshold + 1 - used));
+        auto bytesRead = read(fd, &memory[used], memory.size() - used);
+        memory.resize(used + size_t(std::max(bytesRead, ssize_t(0))));
+
+        if (bytesRead == 0) {
+            return CapturedOutput(std::move(memory));
+        } else if (bytesRead == -1 && errno != EINTR && errno != EAGAIN) {
+            return unexpected("read failed: {}", strerror(errno));
+        }
+    }
+
+    // Over the threshold, spill
+    int file = memfd_create("fty-output", MFD_CLOEXEC);
+    if (file == -1) {
+        file = open(P_tmpdir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    }
+    if (file == -1) {
+        return unexpected("cannot create spill file: {}", strerror(errno));
+    }
+
+    size_t total = memory.size();
+    if (auto ret = details::writeAll(file, memory); !ret) {
+        close(file);
+        return unexpected(ret.error());
+    }
+    memory = std::string();
+
+    int left = -1;
+    if (milliseconds >= 0) {
+        auto rest = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        left      = std::max(0, int(rest.count()));
+    }
+
+    auto moved = spliceFromFd(fd, file, left, input);
+    if (!moved) {
+        close(file);
+        return unexpected(moved.error());
+    }
+    total += *moved;
+
+    auto output = CapturedOutput::map(file, total);
+    close(file);
+    return output;
+}
+
 inline std::string Process::readAllStandardOutput(int milliseconds)
 {
-    return readFromFd(m_stdout, milliseconds);
+    auto output = readWhileWriting(m_stdout, milliseconds);
+    return output + readFromFd(m_stdout, milliseconds);
 }
 
 inline std::string Process::readAllStandardError(int milliseconds)
 {
-    return readFromFd(m_stderr, milliseconds);
+    auto output = readWhileWriting(m_stderr, milliseconds);
+    return output + readFromFd(m_stderr, milliseconds);
+}
+
+inline std::string Process::readWhileWriting(int fd, int milliseconds)
+{
+    std::string output;
+    std::string buffer;
+    while (fd && m_stdin && m_inputPending) {
+        std::array<pollfd, 2> fds = {{{fd, POLLIN, 0}, {m_stdin, POLLOUT, 0}}};
+
+        int res = poll(fds.data(), fds.size(), milliseconds > 0 ? milliseconds : 100);
+        if (res == -1 && errno == EINTR) {
+            continue;
+        } else if (res <= 0) {
+            break;
+        }
+
+        if (fds[1].revents) {
+            flushInput();
+        }
+        if (fds[0].revents) {
+            buffer.resize(65536);
+            auto bytesRead = read(fd, buffer.data(), buffer.size());
+            if (bytesRead > 0) {
+                output.append(buffer.data(), size_t(bytesRead));
+            } else if (bytesRead == 0 || (errno != EINTR && errno != EAGAIN)) {
+                break;
+            }
+        }
+    }
+    return output;
+}
+
+inline Expected<size_t> Process::readAllStandardOutput(std::string& output, int milliseconds)
+{
+    if (!m_stdout) {
+        return unexpected("standard output is not captured");
+    }
+    return readFromFd(m_stdout, output, milliseconds, this);
+}
+
+inline Expected<size_t> Process::readAllStandardError(std::string& output, int milliseconds)
+{
+    if (!m_stderr) {
+        return unexpected("standard error is not captured");
+    }
+    return readFromFd(m_stderr, output, milliseconds, this);
+}
+
+inline Expected<size_t> Process::spliceStandardOutput(int fd, int milliseconds)
+{
+    if (!m_stdout) {
+        return unexpected("standard output is not captured");
+    }
+    return spliceFromFd(m_stdout, fd, milliseconds, this);
+}
+
+inline Expected<CapturedOutput> Process::captureStandardOutput(size_t threshold, int milliseconds)
+{
+    if (!m_stdout) {
+        return unexpected("standard output is not captured");
+    }
+    return captureFromFd(m_stdout, threshold, milliseconds, this);
+}
+
+template <typename Func>
+Expected<void> Process::drain(int milliseconds, bool untilExit, Func&& onData)
+{
+    static constexpr int exitPoll = 100;
+
+    // Outputs first, standard input is polled after them while there is queued input
+    std::array<pollfd, 3> fds;
+    std::array<int, 2>    channels;
+    nfds_t                count = 0;
+
+    if (m_stdout) {
+        fds[count]      = {m_stdout, POLLIN, 0};
+        channels[count] = STDOUT_FILENO;
+        ++count;
+    }
+    if (m_stderr) {
+        fds[count]      = {m_stderr, POLLIN, 0};
+        channels[count] = STDERR_FILENO;
+        ++count;
+    }
+
+    auto                    deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+    std::array<char, 65536> buffer;
+
+    while (count) {
+        int timeout = -1;
+        if (milliseconds >= 0) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            timeout   = std::max(0, int(left.count()));
+        }
+
+        bool writing = m_stdin && m_inputPending;
+        if (writing) {
+            fds[count] = {m_stdin, POLLOUT, 0};
+        }
+
+        bool capped = untilExit && (timeout == -1 || timeout > exitPoll);
+
+        int res = poll(fds.data(), count + (writing ? 1 : 0), capped ? exitPoll : timeout);
+        if (res == -1 && errno == EINTR) {
+            continue;
+        } else if (res == -1) {
+            return unexpected("poll failed: {}", strerror(errno));
+        } else if (res == 0 && capped) {
+            if (hasExited()) {
+                return {};
+            }
+            continue;
+        } else if (res == 0) {
+            return unexpected("timeout");
+        }
+
+        if (writing && fds[count].revents) {
+            // Write error means the child is not reading, it is not a reason to stop reading its output
+            flushInput();
+        }
+
+        for (nfds_t i = 0; i < count;) {
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                auto bytesRead = read(fds[i].fd, buffer.data(), buffer.size());
+                if (bytesRead > 0) {
+                    onData(channels[i], std::string_view(buffer.data(), size_t(bytesRead)));
+                } else if (bytesRead == 0 || (errno != EINTR && errno != EAGAIN)) {
+                    // End of stream, stop polling it
+                    onData(channels[i], std::string_view());
+                    fds[i]      = fds[count - 1];
+                    channels[i] = channels[count - 1];
+                    --count;
+                    continue;
+                }
+            }
+            ++i;
+        }
+    }
+    return {};
+}
+
+inline Expected<void> Process::readAll(std::string& out, std::string& err, int milliseconds)
+{
+    return drain(milliseconds, false, [&](int channel, std::string_view data) {
+        (channel == STDOUT_FILENO ? out : err).append(data);
+    });
+}
+
+inline bool Process::hasExited() const
+{
+    siginfo_t info = {};
+    return m_pid && waitid(P_PID, id_t(m_pid), &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == m_pid;
+}
+
+inline Expected<void> Process::stream(int milliseconds)
+{
+    // Not yet terminated lines
+    std::string outTail;
+    std::string errTail;
+    Streams&    events = streams();
+
+    return drain(milliseconds, false, [&](int channel, std::string_view data) {
+        bool  isOut = channel == STDOUT_FILENO;
+        auto& tail  = isOut ? outTail : errTail;
+        auto& line  = isOut ? events.outputLine : events.errorLine;
+
+        if (data.empty()) {
+            if (!tail.empty()) {
+                line(std::string_view(tail));
+                tail.clear();
+            }
+            return;
+        }
+
+        (isOut ? events.outputData : events.errorData)(std::string_view(data));
+
+        size_t pos;
+        while ((pos = data.find('\n')) != std::string_view::npos) {
+            if (tail.empty()) {
+                line(data.substr(0, pos));
+            } else {
+                tail.append(data.substr(0, pos));
+                line(std::string_view(tail));
+                tail.clear();
+            }
+            data.remove_prefix(pos + 1);
+        }
+        tail.append(data);
+    });
 }
 
 inline bool Process::write(const std::string& cmd)
 {
-    if (m_stdin) {
-        auto ret = ::write(m_stdin, cmd.c_str(), cmd.size());
-        fsync(m_stdin);
-        return ret == ssize_t(cmd.size());
+    if (!m_stdin) {
+        return false;
     }
-    return false;
+    // Keeps order with queued input
+    if (!flush()) {
+        return false;
+    }
+    return bool(details::writeAll(m_stdin, cmd));
 }
 
 inline void Process::closeWriteChannel()
 {
-    if (m_stdin) {
-        close(m_stdin);
-        m_stdin = 0;
+    if (!m_stdin) {
+        return;
+    }
+    if (m_inputPending && flushInput() && m_inputPending) {
+        // Closed by flushInput() when the queue is empty
+        m_closeInput = true;
+        return;
+    }
+    close(m_stdin);
+    m_stdin      = 0;
+    m_closeInput = false;
+}
+
+inline Expected<void> Process::writeAsync(std::string data, int milliseconds)
+{
+    if (!m_stdin) {
+        return unexpected("standard input is not captured");
+    }
+    if (data.empty()) {
+        return {};
+    }
+
+    // Message bigger than the whole queue is accepted once the queue is empty
+    size_t target = m_inputCapacity > data.size() ? m_inputCapacity - data.size() : 0;
+    if (m_inputPending > target) {
+        if (auto ret = flushInputTo(target, milliseconds); !ret) {
+            return unexpected(ret.error());
+        }
+    }
+
+    m_inputPending += data.size();
+    m_input.push_back(std::move(data));
+    return flushInput();
+}
+
+inline Expected<void> Process::flush(int milliseconds)
+{
+    return flushInputTo(0, milliseconds);
+}
+
+inline size_t Process::pendingInput() const
+{
+    return m_inputPending;
+}
+
+inline void Process::setInputBufferSize(size_t bytes)
+{
+    m_inputCapacity = bytes;
+}
+
+inline Expected<void> Process::flushInput()
+{
+    if (m_input.empty()) {
+        if (m_closeInput) {
+            closeWriteChannel();
+        }
+        return {};
+    }
+
+    std::array<iovec, 64> iov;
+    details::SigPipeGuard guard;
+    while (!m_input.empty()) {
+        size_t count = 0;
+        for (auto it = m_input.begin(); it != m_input.end() && count < iov.size(); ++it, ++count) {
+            size_t offset       = count == 0 ? m_inputOffset : 0;
+            iov[count].iov_base = const_cast<char*>(it->data() + offset);
+            iov[count].iov_len  = it->size() - offset;
+        }
+
+        auto written = writev(m_stdin, iov.data(), int(count));
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                return {};
+            }
+            int error = errno;
+            guard.failed(error);
+            // Child does not read anymore, queued input is lost
+            m_input.clear();
+            m_inputOffset  = 0;
+            m_inputPending = 0;
+            if (m_closeInput) {
+                closeWriteChannel();
+            }
+            return unexpected("write failed: {}", strerror(error));
+        }
+
+        m_inputPending -= size_t(written);
+        auto left = size_t(written);
+        while (left) {
+            size_t size = m_input.front().size() - m_inputOffset;
+            if (left < size) {
+                m_inputOffset += left;
+                break;
+            }
+            left -= size;
+            m_input.pop_front();
+            m_inputOffset = 0;
+        }
+    }
+
+    if (m_closeInput) {
+        closeWriteChannel();
+    }
+    return {};
+}
+
+inline Expected<void> Process::flushInputTo(size_t target, int milliseconds)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+    while (true) {
+        if (auto ret = flushInput(); !ret) {
+            return unexpected(ret.error());
+        }
+        if (m_inputPending <= target) {
+            return {};
+        }
+
+        int timeout = -1;
+        if (milliseconds >= 0) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            timeout   = std::max(0, int(left.count()));
+        }
+
+        pollfd pfd = {m_stdin, POLLOUT, 0};
+        int    res = poll(&pfd, 1, timeout);
+        if (res == 0) {
+            return unexpected("timeout");
+        } else if (res == -1 && errno != EINTR) {
+            return unexpected("poll failed: {}", strerror(errno));
+        }
     }
 }
 
 inline void Process::setEnvVar(const std::string& name, const std::string& val)
 {
     try {
-        m_environ.push_back(fmt::format("{}={}", name, val));
+        auto var = fmt::format("{}={}", name, val);
+        for (auto& over : m_envOverlay) {
+            if (over.compare(0, name.size() + 1, var, 0, name.size() + 1) == 0) {
+                over = std::move(var);
+                return;
+            }
+        }
+        m_envOverlay.push_back(std::move(var));
     } catch (const fmt::format_error&) {
     }
 }
@@ -350,6 +1532,26 @@ inline void Process::addArgument(const std::string& arg)
     m_args.push_back(arg);
 }
 
+inline void Process::setEnvironment(const Environment::Ptr& environment)
+{
+    m_environment = environment;
+}
+
+inline void Process::setSpawnConfig(const SpawnConfig& config)
+{
+    m_spawnConfig = config;
+}
+
+inline void Process::setStandardInput(int fd)
+{
+    m_inFd = fd;
+}
+
+inline void Process::setStandardOutput(int fd)
+{
+    m_outFd = fd;
+}
+
 
 inline void Process::interrupt()
 {
@@ -389,11 +1591,16 @@ inline Expected<int> Process::run(const std::string& cmd, const Arguments& args,
     if (auto ret = proc.run(); !ret) {
         return unexpected(ret.error());
     }
-    out      = proc.readAllStandardOutput();
-    err      = proc.readAllStandardError();
+    out.clear();
+    err.clear();
+    // Not until end of file, background descendants of the child can keep the outputs open
+    auto append = [&](int channel, std::string_view data) {
+        (channel == STDOUT_FILENO ? out : err).append(data);
+    };
+    if (auto ret = proc.drain(-1, true, append); !ret) {
+        return unexpected(ret.error());
+    }
     auto ret = proc.wait();
-    out      += proc.readAllStandardOutput();
-    err      += proc.readAllStandardError();
     if (ret) {
         return *ret;
     } else {
@@ -407,9 +1614,15 @@ inline Expected<int> Process::run(const std::string& cmd, const Arguments& args,
     if (auto ret = proc.run(); !ret) {
         return unexpected(ret.error());
     }
-    out      = proc.readAllStandardOutput();
+    out.clear();
+    // Not until end of file, background descendants of the child can keep the output open
+    auto append = [&](int, std::string_view data) {
+        out.append(data);
+    };
+    if (auto ret = proc.drain(-1, true, append); !ret) {
+        return unexpected(ret.error());
+    }
     auto ret = proc.wait();
-    out      += proc.readAllStandardOutput();
     if (ret) {
         return *ret;
     } else {
@@ -0,0 +1,395 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+#pragma once
+#include <array>
+#include <cstring>
+#include <string_view>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#include <immintrin.h>
+#define FTY_SCAN_X86 1
+#endif
+
+namespace fty::detail {
+
+// ===========================================================================================================
+
+/// Instruction set used by the scanning kernels
+enum class ScanLevel
+{
+    Scalar,
+    Sse2,
+    Avx2
+};
+
+/// Byte scanning kernels used by split and trim. Positions are offsets from the start of the buffer.
+struct ScanKernels
+{
+    /// First @ref ch, or size if not found
+    size_t (*findChar)(const char* data, size_t size, char ch);
+    /// First of any byte of @ref set, or size if not found
+    size_t (*findAnyOf)(const char* data, size_t size, const char* set, size_t setSize);
+    /// First occurrence of @ref needle, or size if not found
+    size_t (*findString)(const char* data, size_t size, const char* needle, size_t needleSize);
+    /// First byte which is not a whitespace (" \t\n\r"), or size if there is none
+    size_t (*skipSpace)(const char* data, size_t size);
+    /// One past the last byte which is not a whitespace, or 0 if there is none
+    size_t (*skipSpaceBack)(const char* data, size_t size);
+};
+
+/// Returns the best instruction set supported by the CPU, detected once
+ScanLevel scanLevel();
+
+/// Returns kernels for the given instruction set, or for the best supported one below it
+const ScanKernels& scanKernels(ScanLevel level);
+
+/// Returns kernels for the best instruction set supported by the CPU
+const ScanKernels& scanKernels();
+
+// ===========================================================================================================
+
+namespace scan {
+
+    inline bool isSpace(char ch)
+    {
+        return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+    }
+
+    // Scalar ---------------------------------------------------------------------------------------------------
+
+    inline size_t findCharScalar(const char* data, size_t size, char ch)
+    {
+        if (!size) {
+            return 0;
+        }
+        // memchr of the libc is usually vectorized already
+        auto found = static_cast<const char*>(memchr(data, ch, size));
+        return found ? size_t(found - data) : size;
+    }
+
+    inline size_t findAnyOfScalar(const char* data, size_t size, const char* set, size_t setSize)
+    {
+        if (setSize == 1) {
+            return findCharScalar(data, size, *set);
+        }
+
+        std::array<bool, 256> table = {};
+        for (size_t i = 0; i < setSize; ++i) {
+            table[static_cast<unsigned char>(set[i])] = true;
+        }
+        for (size_t i = 0; i < size; ++i) {
+            if (table[static_cast<unsigned char>(data[i])]) {
+                return i;
+            }
+        }
+        return size;
+    }
+
+    inline size_t findStringScalar(const char* data, size_t size, const char* needle, size_t needleSize)
+    {
+        if (!needleSize) {
+            return 0;
+        }
+        if (needleSize == 1) {
+            return findCharScalar(data, size, *needle);
+        }
+#ifdef __GLIBC__
+        // Two-Way algorithm in glibc, linear for any needle
+        auto found = static_cast<const char*>(memmem(data, size, needle, needleSize));
+        return found ? size_t(found - data) : size;
+#else
+        auto pos = std::string_view(data, size).find(std::string_view(needle, needleSize));
+        return pos == std::string_view::npos ? size : pos;
+#endif
+    }
+
+    inline size_t skipSpaceScalar(const char* data, size_t size)
+    {
+        size_t i = 0;
+        while (i < size && isSpace(data[i])) {
+            ++i;
+        }
+        return i;
+    }
+
+    inline size_t skipSpaceBackScalar(const char* data, size_t size)
+    {
+        while (size && isSpace(data[size - 1])) {
+            --size;
+        }
+        return size;
+    }
+
+#ifdef FTY_SCAN_X86
+
+    // Sets larger than this are looked up in a table, comparing with every byte would be slower
+    constexpr size_t maxVectorSet = 8;
+
+    // SSE2 -----------------------------------------------------------------------------------------------------
+
+    inline unsigned spaceMaskSse2(__m128i block)
+    {
+        __m128i space = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\t')));
+        space         = _mm_or_si128(space, _mm_cmpeq_epi8(block, _mm_set1_epi8('\n')));
+        space         = _mm_or_si128(space, _mm_cmpeq_epi8(block, _mm_set1_epi8('\r')));
+        return unsigned(_mm_movemask_epi8(space));
+    }
+
+    inline size_t findCharSse2(const char* data, size_t size, char ch)
+    {
+        const __m128i needle = _mm_set1_epi8(ch);
+
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            if (unsigned mask = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)))) {
+                return i + unsigned(__builtin_ctz(mask));
+            }
+        }
+        return i + findCharScalar(data + i, size - i, ch);
+    }
+
+    inline size_t findAnyOfSse2(const char* data, size_t size, const char* set, size_t setSize)
+    {
+        if (setSize == 1) {
+            return findCharSse2(data, size, *set);
+        }
+        if (setSize > maxVectorSet) {
+            return findAnyOfScalar(data, size, set, setSize);
+        }
+
+        __m128i needles[maxVectorSet];
+        for (size_t j = 0; j < setSize; ++j) {
+            needles[j] = _mm_set1_epi8(set[j]);
+        }
+
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            __m128i found = _mm_setzero_si128();
+            for (size_t j = 0; j < setSize; ++j) {
+                found = _mm_or_si128(found, _mm_cmpeq_epi8(block, needles[j]));
+            }
+            if (unsigned mask = unsigned(_mm_movemask_epi8(found))) {
+                return i + unsigned(__builtin_ctz(mask));
+            }
+        }
+        return i + findAnyOfScalar(data + i, size - i, set, setSize);
+    }
+
+    inline size_t findStringSse2(const char* data, size_t size, const char* needle, size_t needleSize)
+    {
+        if (needleSize < 2) {
+            return needleSize ? findCharSse2(data, size, *needle) : 0;
+        }
+
+        // Candidates match first and last byte of the needle, only those are compared
+        const __m128i first = _mm_set1_epi8(needle[0]);
+        const __m128i last  = _mm_set1_epi8(needle[needleSize - 1]);
+
+        size_t i = 0;
+        for (; i + needleSize - 1 + 16 <= size; i += 16) {
+            __m128i blockFirst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            __m128i blockLast  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + needleSize - 1));
+            unsigned mask      = unsigned(_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(blockFirst, first), _mm_cmpeq_epi8(blockLast, last))));
+            for (; mask; mask &= mask - 1) {
+                size_t pos = i + unsigned(__builtin_ctz(mask));
+                if (memcmp(data + pos + 1, needle + 1, needleSize - 2) == 0) {
+                    return pos;
+                }
+            }
+        }
+        return i + findStringScalar(data + i, size - i, needle, needleSize);
+    }
+
+    inline size_t skipSpaceSse2(const char* data, size_t size)
+    {
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16) {
+            unsigned mask = ~spaceMaskSse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i))) & 0xFFFFu;
+            if (mask) {
+                return i + unsigned(__builtin_ctz(mask));
+            }
+        }
+        return i + skipSpaceScalar(data + i, size - i);
+    }
+
+    inline size_t skipSpaceBackSse2(const char* data, size_t size)
+    {
+        for (; size >= 16; size -= 16) {
+            unsigned mask = ~spaceMaskSse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + size - 16))) & 0xFFFFu;
+            if (mask) {
+                return size - 16 + unsigned(32 - __builtin_clz(mask));
+            }
+        }
+        return skipSpaceBackScalar(data, size);
+    }
+
+    // AVX2 -----------------------------------------------------------------------------------------------------
+
+    __attribute__((target("avx2"))) inline unsigned spaceMaskAvx2(__m256i block)
+    {
+        __m256i space = _mm256_or_si256(
+            _mm256_cmpeq_epi8(block, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\t')));
+        space = _mm256_or_si256(space, _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\n')));
+        space = _mm256_or_si256(space, _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\r')));
+        return unsigned(_mm256_movemask_epi8(space));
+    }
+
+    __attribute__((target("avx2"))) inline size_t findCharAvx2(const char* data, size_t size, char ch)
+    {
+        const __m256i needle = _mm256_set1_epi8(ch);
+
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32) {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            if (unsigned mask = unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)))) {
+                return i + unsigned(__builtin_ctz(mask));
+            }
+        }
+        return i + findCharSse2(data + i, size - i, ch);
+    }
+
+    __attribute__((target("avx2"))) inline size_t findAnyOfAvx2(const char* data, size_t size, const char* set, size_t setSize)
+    {
+        if (setSize == 1) {
+            return findCharAvx2(data, size, *set);
+        }
+        if (setSize > maxVectorSet) {
+            return findAnyOfScalar(data, size, set, setSize);
+        }
+
+        __m256i needles[maxVectorSet];
+        for (size_t j = 0; j < setSize; ++j) {
+            needles[j] = _mm256_set1_epi8(set[j]);
+        }
+
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32) {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            __m256i found = _mm256_setzero_si256();
+            for (size_t j = 0; j < setSize; ++j) {
+                found = _mm256_or_si256(found, _mm256_cmpeq_epi8(block, needles[j]));
+            }
+            if (unsigned mask = unsigned(_mm256_movemask_epi8(found))) {
+                return i + unsigned(__builtin_ctz(mask));
+            }
+        }
+        return i + findAnyOfSse2(data + i, size - i, set, setSize);
+    }
+
+    __attribute__((target("avx2"))) inline size_t findStringAvx2(
+        const char* data, size_t size, const char* needle, size_t needleSize)
+    {
+        if (needleSize < 2) {
+            return needleSize ? findCharAvx2(data, size, *needle) : 0;
+        }
+
+        const __m256i first = _mm256_set1_epi8(needle[0]);
+        const __m256i last  = _mm256_set1_epi8(needle[needleSize - 1]);
+
+        size_t i = 0;
+        for (; i + needleSize - 1 + 32 <= size; i += 32) {
+            __m256i blockFirst = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            __m256i blockLast  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + needleSize - 1));
+            unsigned mask      = unsigned(_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(blockFirst, first), _mm256_cmpeq_epi8(blockLast, last))));
+            for (; mask; mask &= mask - 1) {
+                size_t pos = i + unsigned(__builtin_ctz(mask));
+                if (memcmp(data + pos + 1, needle + 1, needleSize - 2) == 0) {
+                    return pos;
+                }
+            }
+        }
+        return i + findStringSse2(data + i, size - i, needle, needleSize);
+    }
+
+    __attribute__((target("avx2"))) inline size_t skipSpaceAvx2(const char* data, size_t size)
+    {
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32) {
+            unsigned mask = ~spaceMaskAvx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)));
+            if (mask) {
+                return i + unsigned(__builtin_ctz(mask));
+            }
+        }
+        return i + skipSpaceSse2(data + i, size - i);
+    }
+
+    __attribute__((target("avx2"))) inline size_t skipSpaceBackAvx2(const char* data, size_t size)
+    {
+        for (; size >= 32; size -= 32) {
+            unsigned mask = ~spaceMaskAvx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + size - 32)));
+            if (mask) {
+                return size - 32 + unsigned(32 - __builtin_clz(mask));
+            }
+        }
+        return skipSpaceBackSse2(data, size);
+    }
+
+#endif
+
+} // namespace scan
+
+// ===========================================================================================================
+
+inline ScanLevel scanLevel()
+{
+#ifdef FTY_SCAN_X86
+    static const ScanLevel level = __builtin_cpu_supports("avx2") ? ScanLevel::Avx2 : ScanLevel::Sse2;
+    return level;
+#else
+    return ScanLevel::Scalar;
+#endif
+}
+
+inline const ScanKernels& scanKernels(ScanLevel level)
+{
+    static constexpr ScanKernels scalar = {scan::findCharScalar, scan::findAnyOfScalar, scan::findStringScalar,
+        scan::skipSpaceScalar, scan::skipSpaceBackScalar};
+#ifdef FTY_SCAN_X86
+    static constexpr ScanKernels sse2 = {
+        scan::findCharSse2, scan::findAnyOfSse2, scan::findStringSse2, scan::skipSpaceSse2, scan::skipSpaceBackSse2};
+    static constexpr ScanKernels avx2 = {
+        scan::findCharAvx2, scan::findAnyOfAvx2, scan::findStringAvx2, scan::skipSpaceAvx2, scan::skipSpaceBackAvx2};
+
+    if (level > scanLevel()) {
+        level = scanLevel();
+    }
+    switch (level) {
+        case ScanLevel::Avx2:
+            return avx2;
+        case ScanLevel::Sse2:
+            return sse2;
+        case ScanLevel::Scalar:
+            return scalar;
+    }
+#else
+    (void)level;
+#endif
+    return scalar;
+}
+
+inline const ScanKernels& scanKernels()
+{
+    static const ScanKernels& kernels = scanKernels(scanLevel());
+    return kernels;
+}
+
+// ===========================================================================================================
+
+} // namespace fty::detail
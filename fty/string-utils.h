@@ -16,9 +16,16 @@
 #pragma once
 #include "convert.h"
 #include "flags.h"
+#include "string-scan.h"
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <regex>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace fty {
@@ -47,14 +54,124 @@ void trim(std::string& str);
 /// @return trimmed string
 std::string trimmed(const std::string& str);
 
+/// Returns a view that has whitespace removed from the start and the end, nothing is copied.
+/// @param str string to trim
+/// @return trimmed view into @ref str
+std::string_view trimmedView(std::string_view str);
+
 /// Splits the string into substrings wherever @ref delim occurs. If @ref delim does not match anywhere in the
-/// string, split() returns a single-element list containing this string.
+/// string (or is empty), split() returns a single-element list containing this string.
 /// @param str string to split
 /// @param delim delimeter to split
 /// @param opt split options
 std::vector<std::string> split(
     const std::string& str, const std::string& delim, SplitOption opt = SplitOption::SkipEmpty | SplitOption::Trim);
 
+/// Splits the string into views wherever @ref delim occurs, nothing is copied. Views point into @ref str, so
+/// it must outlive them. @ref out is cleared first, pass the same container to reuse its memory across calls.
+/// @param str string to split
+/// @param delim delimeter to split
+/// @param out fields of the string
+/// @param opt split options
+/// @return @ref out
+std::vector<std::string_view>& split(std::string_view str, std::string_view delim, std::vector<std::string_view>& out,
+    SplitOption opt = SplitOption::SkipEmpty | SplitOption::Trim);
+
+/// Splits the string into substrings wherever any character of @ref delims occurs, like " \t,".
+/// @param str string to split
+/// @param delims set of delimiter characters
+/// @param opt split options
+std::vector<std::string> splitAnyOf(
+    const std::string& str, const std::string& delims, SplitOption opt = SplitOption::SkipEmpty | SplitOption::Trim);
+
+/// Splits the string into views wherever any character of @ref delims occurs, see split() with views.
+/// @param str string to split
+/// @param delims set of delimiter characters
+/// @param out fields of the string
+/// @param opt split options
+/// @return @ref out
+std::vector<std::string_view>& splitAnyOf(std::string_view str, std::string_view delims, std::vector<std::string_view>& out,
+    SplitOption opt = SplitOption::SkipEmpty | SplitOption::Trim);
+
+/// Lazy range of the fields of a string, see splitView()
+class SplitView
+{
+public:
+    /// How the delimiter is matched
+    enum class Delimiter
+    {
+        String, //! Whole delimiter string
+        AnyOf   //! Any single character of the delimiter string
+    };
+
+public:
+    class iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = std::string_view;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const std::string_view*;
+        using reference         = const std::string_view&;
+
+        iterator() = default;
+
+        reference operator*() const;
+        pointer   operator->() const;
+        iterator& operator++();
+        iterator  operator++(int);
+        bool      operator==(const iterator& other) const;
+        bool      operator!=(const iterator& other) const;
+
+    private:
+        friend class SplitView;
+        iterator(const SplitView* view, size_t begin);
+        void next();
+
+    private:
+        const SplitView* m_view    = nullptr;
+        size_t           m_current = std::string_view::npos;
+        size_t           m_next    = std::string_view::npos;
+        std::string_view m_field;
+    };
+
+public:
+    SplitView(std::string_view str, std::string_view delim, SplitOption opt, Delimiter type = Delimiter::String);
+
+    iterator begin() const;
+    iterator end() const;
+
+    /// Returns true if there is no field at all
+    bool empty() const;
+
+private:
+    /// Position of the next delimiter from @ref from, or npos
+    size_t find(size_t from) const;
+
+private:
+    std::string_view m_str;
+    std::string_view m_delim;
+    SplitOption      m_opt;
+    Delimiter        m_type;
+};
+
+/// Splits the string lazily: fields are found one by one while iterating, so the loop can stop after the
+/// first few of them without scanning the rest. Fields are views into @ref str, which must outlive the range.
+/// @code
+/// for (auto field : fty::splitView(line, ",")) { ... }
+/// @endcode
+/// @param str string to split
+/// @param delim delimeter to split
+/// @param opt split options
+SplitView splitView(std::string_view str, std::string_view delim, SplitOption opt = SplitOption::SkipEmpty | SplitOption::Trim);
+
+/// Splits the string lazily wherever any character of @ref delims occurs, see splitView()
+/// @param str string to split
+/// @param delims set of delimiter characters
+/// @param opt split options
+SplitView splitViewAnyOf(
+    std::string_view str, std::string_view delims, SplitOption opt = SplitOption::SkipEmpty | SplitOption::Trim);
+
 /// Splits the string into substrings wherever the regular expression @ref delim matches, and returns the list
 /// of those strings. If @ref delim does not match anywhere in the string, split() returns a single-element
 /// list containing this string.
@@ -64,6 +181,54 @@ std::vector<std::string> split(
 std::vector<std::string> split(
     const std::string& str, const std::regex& delim, SplitOption opt = SplitOption::SkipEmpty | SplitOption::Trim);
 
+/// Regular expression to split with, compiled once. Simple patterns, like a literal string, "\\s+" or "[,;]+",
+/// are recognized while compiling and split without std::regex at all.
+class SplitPattern
+{
+public:
+    /// @param pattern regular expression
+    /// @param flags regular expression flags
+    /// @throws std::regex_error if the pattern is not valid
+    explicit SplitPattern(const std::string& pattern, std::regex::flag_type flags = std::regex::ECMAScript);
+
+    /// Returns the pattern compiled by the process wide cache, keyed by pattern and flags. Thread safe.
+    /// @throws std::regex_error if the pattern is not valid
+    static std::shared_ptr<const SplitPattern> cached(
+        const std::string& pattern, std::regex::flag_type flags = std::regex::ECMAScript);
+
+    /// Returns true if the pattern is split without std::regex
+    bool isSimple() const;
+
+    /// Splits the string, same as split() with the std::regex
+    std::vector<std::string> split(const std::string& str, SplitOption opt) const;
+
+private:
+    bool parse(const std::string& pattern, std::regex::flag_type flags);
+
+private:
+    std::optional<std::regex> m_regex;
+    std::string               m_delim;
+    SplitView::Delimiter      m_type = SplitView::Delimiter::String;
+    /// Run of delimiters is one delimiter, like "[,;]+"
+    bool m_runs = false;
+};
+
+/// Splits the string wherever the precompiled @ref delim matches, see split() with std::regex
+/// @param str string to split
+/// @param delim pattern to split
+/// @param opt split options
+std::vector<std::string> split(
+    const std::string& str, const SplitPattern& delim, SplitOption opt = SplitOption::SkipEmpty | SplitOption::Trim);
+
+/// Splits the string wherever the regular expression @ref pattern matches. The pattern is compiled once and
+/// taken from the cache afterwards, see SplitPattern::cached().
+/// @param str string to split
+/// @param pattern regular expression to split
+/// @param opt split options
+/// @throws std::regex_error if the pattern is not valid
+std::vector<std::string> splitRegex(
+    const std::string& str, const std::string& pattern, SplitOption opt = SplitOption::SkipEmpty | SplitOption::Trim);
+
 /// Splits the string into typed tuple wherever the @ref delim occurs matches. In case if split will produce
 /// less values then tuple size then will contain default values. If split will produce more values, unused
 /// parts will be ingnored
@@ -84,6 +249,15 @@ template <typename... T>
 std::tuple<T...> split(
     const std::string& str, const std::regex& delim, SplitOption opt = SplitOption::KeepEmpty | SplitOption::Trim);
 
+/// Splits the string into typed tuple wherever the regular expression @ref pattern matches, the pattern is
+/// taken from the cache, see splitRegex().
+/// @param str string to split
+/// @param pattern regular expression to split
+/// @param opt split options
+template <typename... T>
+std::tuple<T...> splitRegex(
+    const std::string& str, const std::string& pattern, SplitOption opt = SplitOption::KeepEmpty | SplitOption::Trim);
+
 /// Converts string to upper case
 /// @param str string to convert
 void toupper(std::string& src);
@@ -116,13 +290,22 @@ namespace detail {
         }
     }
 
+    /// Calls @ref func with every field of the string, as a view
+    template <typename Func>
+    void splitEach(std::string_view str, std::string_view delim, SplitOption opt, SplitView::Delimiter type, Func&& func)
+    {
+        for (auto field : SplitView(str, delim, opt, type)) {
+            func(field);
+        }
+    }
+
 } // namespace detail
 
 inline void trim(std::string& str)
 {
-    static std::string toTrim = " \t\n\r";
-    str.erase(str.find_last_not_of(toTrim) + 1);
-    str.erase(0, str.find_first_not_of(toTrim));
+    const auto& kernels = detail::scanKernels();
+    str.erase(kernels.skipSpaceBack(str.data(), str.size()));
+    str.erase(0, kernels.skipSpace(str.data(), str.size()));
 }
 
 inline std::string trimmed(const std::string& str)
@@ -132,24 +315,179 @@ inline std::string trimmed(const std::string& str)
     return ret;
 }
 
-inline std::vector<std::string> split(const std::string& str, const std::string& delim, SplitOption opt)
+inline std::string_view trimmedView(std::string_view str)
 {
-    size_t                   pos   = 0;
-    size_t                   begin = 0;
-    std::vector<std::string> ret;
+    const auto& kernels = detail::scanKernels();
+    auto        begin   = kernels.skipSpace(str.data(), str.size());
+    return str.substr(begin, kernels.skipSpaceBack(str.data() + begin, str.size() - begin));
+}
+
+inline SplitView::iterator::iterator(const SplitView* view, size_t begin)
+    : m_view(view)
+    , m_next(begin)
+{
+    next();
+}
+
+inline SplitView::iterator::reference SplitView::iterator::operator*() const
+{
+    return m_field;
+}
+
+inline SplitView::iterator::pointer SplitView::iterator::operator->() const
+{
+    return &m_field;
+}
+
+inline SplitView::iterator& SplitView::iterator::operator++()
+{
+    next();
+    return *this;
+}
+
+inline SplitView::iterator SplitView::iterator::operator++(int)
+{
+    iterator ret = *this;
+    next();
+    return ret;
+}
+
+inline bool SplitView::iterator::operator==(const iterator& other) const
+{
+    // Start of the current field identifies the position, end is npos
+    return m_current == other.m_current;
+}
+
+inline bool SplitView::iterator::operator!=(const iterator& other) const
+{
+    return !(*this == other);
+}
+
+inline void SplitView::iterator::next()
+{
+    const auto& str = m_view->m_str;
+    const auto  opt = m_view->m_opt;
+
+    while (m_next != std::string_view::npos) {
+        m_current = m_next;
+
+        std::string_view field;
+        auto             pos = m_view->find(m_next);
+        if (pos != std::string_view::npos) {
+            field  = str.substr(m_next, pos - m_next);
+            m_next = pos + (m_view->m_type == Delimiter::AnyOf ? 1 : m_view->m_delim.size());
+        } else if (m_next < str.size()) {
+            field  = str.substr(m_next);
+            m_next = std::string_view::npos;
+        } else {
+            break;
+        }
 
-    while ((pos = str.find(delim, begin)) != std::string::npos) {
-        detail::addString(ret, opt, str.substr(begin, pos - begin));
-        begin = pos + 1;
+        if (isSet(opt, SplitOption::SkipEmpty) && field.empty()) {
+            continue;
+        }
+        m_field = isSet(opt, SplitOption::Trim) ? trimmedView(field) : field;
+        return;
     }
 
-    if (begin < str.size()) {
-        detail::addString(ret, opt, str.substr(begin, str.size() - begin));
+    m_current = m_next = std::string_view::npos;
+    m_field   = {};
+}
+
+inline SplitView::SplitView(std::string_view str, std::string_view delim, SplitOption opt, Delimiter type)
+    : m_str(str)
+    , m_delim(delim)
+    , m_opt(opt)
+    , m_type(type)
+{
+}
+
+inline size_t SplitView::find(size_t from) const
+{
+    // Empty delimiter never matches, it would not move forward
+    if (m_delim.empty() || from >= m_str.size()) {
+        return std::string_view::npos;
+    }
+
+    const auto& kernels = detail::scanKernels();
+    const char* data    = m_str.data() + from;
+    size_t      size    = m_str.size() - from;
+
+    size_t pos;
+    if (m_delim.size() == 1) {
+        pos = kernels.findChar(data, size, m_delim.front());
+    } else if (m_type == Delimiter::AnyOf) {
+        pos = kernels.findAnyOf(data, size, m_delim.data(), m_delim.size());
+    } else {
+        pos = kernels.findString(data, size, m_delim.data(), m_delim.size());
     }
+    return pos < size ? from + pos : std::string_view::npos;
+}
+
+inline SplitView::iterator SplitView::begin() const
+{
+    return iterator(this, 0);
+}
+
+inline SplitView::iterator SplitView::end() const
+{
+    return iterator();
+}
+
+inline bool SplitView::empty() const
+{
+    return begin() == end();
+}
 
+inline SplitView splitView(std::string_view str, std::string_view delim, SplitOption opt)
+{
+    return SplitView(str, delim, opt);
+}
+
+inline SplitView splitViewAnyOf(std::string_view str, std::string_view delims, SplitOption opt)
+{
+    return SplitView(str, delims, opt, SplitView::Delimiter::AnyOf);
+}
+
+inline std::vector<std::string> split(const std::string& str, const std::string& delim, SplitOption opt)
+{
+    // Fields are trimmed as views, so every field is copied once
+    std::vector<std::string> ret;
+    detail::splitEach(str, delim, opt, SplitView::Delimiter::String, [&](std::string_view field) {
+        ret.emplace_back(field);
+    });
     return ret;
 }
 
+inline std::vector<std::string_view>& split(
+    std::string_view str, std::string_view delim, std::vector<std::string_view>& out, SplitOption opt)
+{
+    out.clear();
+    detail::splitEach(str, delim, opt, SplitView::Delimiter::String, [&](std::string_view field) {
+        out.push_back(field);
+    });
+    return out;
+}
+
+inline std::vector<std::string> splitAnyOf(const std::string& str, const std::string& delims, SplitOption opt)
+{
+    std::vector<std::string> ret;
+    detail::splitEach(str, delims, opt, SplitView::Delimiter::AnyOf, [&](std::string_view field) {
+        ret.emplace_back(field);
+    });
+    return ret;
+}
+
+inline std::vector<std::string_view>& splitAnyOf(
+    std::string_view str, std::string_view delims, std::vector<std::string_view>& out, SplitOption opt)
+{
+    out.clear();
+    detail::splitEach(str, delims, opt, SplitView::Delimiter::AnyOf, [&](std::string_view field) {
+        out.push_back(field);
+    });
+    return out;
+}
+
 inline std::vector<std::string> split(const std::string& str, const std::regex& delim, SplitOption opt)
 {
     std::vector<std::string> ret;
@@ -173,6 +511,16 @@ inline std::vector<std::string> split(const std::string& str, const std::regex&
     return ret;
 }
 
+inline std::vector<std::string> split(const std::string& str, const SplitPattern& delim, SplitOption opt)
+{
+    return delim.split(str, opt);
+}
+
+inline std::vector<std::string> splitRegex(const std::string& str, const std::string& pattern, SplitOption opt)
+{
+    return SplitPattern::cached(pattern)->split(str, opt);
+}
+
 template <typename... T>
 std::tuple<T...> split(const std::string& str, const std::string& delim, SplitOption opt)
 {
@@ -185,6 +533,193 @@ std::tuple<T...> split(const std::string& str, const std::regex& delim, SplitOpt
     return detail::vectorToTuple<T...>(split(str, delim, opt), std::make_index_sequence<sizeof...(T)>());
 }
 
+template <typename... T>
+std::tuple<T...> splitRegex(const std::string& str, const std::string& pattern, SplitOption opt)
+{
+    return detail::vectorToTuple<T...>(splitRegex(str, pattern, opt), std::make_index_sequence<sizeof...(T)>());
+}
+
+inline SplitPattern::SplitPattern(const std::string& pattern, std::regex::flag_type flags)
+{
+    if (!parse(pattern, flags)) {
+        m_regex.emplace(pattern, flags);
+    }
+}
+
+inline std::shared_ptr<const SplitPattern> SplitPattern::cached(const std::string& pattern, std::regex::flag_type flags)
+{
+    // Patterns are mostly literals from the code, so the cache stays small. It is dropped if it grows
+    // anyway, patterns in use are kept alive by their owners.
+    static constexpr size_t maxEntries = 256;
+
+    using Key = std::pair<std::regex::flag_type, std::string>;
+
+    static std::mutex                                          mutex;
+    static std::map<Key, std::shared_ptr<const SplitPattern>> cache;
+
+    Key key(flags, pattern);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (auto it = cache.find(key); it != cache.end()) {
+            return it->second;
+        }
+    }
+
+    // Compiled outside the lock, a concurrent compilation of the same pattern is just wasted
+    auto compiled = std::make_shared<const SplitPattern>(pattern, flags);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (cache.size() >= maxEntries) {
+        cache.clear();
+    }
+    return cache.emplace(std::move(key), std::move(compiled)).first->second;
+}
+
+inline bool SplitPattern::isSimple() const
+{
+    return !m_regex;
+}
+
+inline std::vector<std::string> SplitPattern::split(const std::string& str, SplitOption opt) const
+{
+    if (m_regex) {
+        return fty::split(str, *m_regex, opt);
+    }
+
+    // Same fields as std::sregex_token_iterator: leading empty field is kept, trailing one is not, and a string
+    // without any match is one field, even if it is empty
+    std::vector<std::string> ret;
+    if (str.empty()) {
+        if (!isSet(opt, SplitOption::SkipEmpty)) {
+            ret.emplace_back();
+        }
+        return ret;
+    }
+
+    bool                     leading = true;
+    for (auto field : SplitView(str, m_delim, SplitOption::KeepEmpty | SplitOption::NoTrim, m_type)) {
+        bool skip = field.empty() && ((m_runs && !leading) || isSet(opt, SplitOption::SkipEmpty));
+        leading   = false;
+        if (skip) {
+            continue;
+        }
+        ret.emplace_back(isSet(opt, SplitOption::Trim) ? trimmedView(field) : field);
+    }
+    return ret;
+}
+
+inline bool SplitPattern::parse(const std::string& pattern, std::regex::flag_type flags)
+{
+    // Only plain ECMAScript, icase and other grammars are left to std::regex
+    if (flags & ~(std::regex::ECMAScript | std::regex::optimize | std::regex::nosubs)) {
+        return false;
+    }
+
+    static constexpr std::string_view meta    = "^$\\.*+?()[]{}|";
+    static constexpr std::string_view spaces  = " \t\n\r\f\v";
+    static constexpr std::string_view escaped = "^$\\.*+?()[]{}|/-";
+
+    // Escape in or out of a class: appends the characters it stands for
+    auto escape = [&](char ch, std::string& out) {
+        switch (ch) {
+            case 't':
+                out += '\t';
+                return true;
+            case 'n':
+                out += '\n';
+                return true;
+            case 'r':
+                out += '\r';
+                return true;
+            case 's':
+                out += spaces;
+                return true;
+            default:
+                if (escaped.find(ch) == std::string_view::npos) {
+                    return false;
+                }
+                out += ch;
+                return true;
+        }
+    };
+
+    std::string literal;
+    std::string set;
+    size_t      i = 0;
+    while (i < pattern.size()) {
+        char ch = pattern[i];
+        if (ch == '\\' && i + 1 < pattern.size()) {
+            std::string chars;
+            if (!escape(pattern[i + 1], chars)) {
+                return false;
+            }
+            if (chars.size() > 1) {
+                // \s is a class
+                set = chars;
+            } else {
+                literal += chars;
+            }
+            i += 2;
+        } else if (ch == '[') {
+            if (i + 1 >= pattern.size() || pattern[i + 1] == '^' || pattern[i + 1] == ']') {
+                return false;
+            }
+            for (++i; i < pattern.size() && pattern[i] != ']'; ++i) {
+                if (pattern[i] == '\\') {
+                    if (++i == pattern.size() || !escape(pattern[i], set)) {
+                        return false;
+                    }
+                } else if (pattern[i] == '[') {
+                    return false;
+                } else if (i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+                    if (pattern[i + 2] == '\\' || pattern[i] > pattern[i + 2]) {
+                        return false;
+                    }
+                    for (int c = pattern[i]; c <= pattern[i + 2]; ++c) {
+                        set += char(c);
+                    }
+                    i += 2;
+                } else {
+                    set += pattern[i];
+                }
+            }
+            if (i == pattern.size()) {
+                return false;
+            }
+            ++i;
+        } else if (meta.find(ch) != std::string_view::npos) {
+            return false;
+        } else {
+            literal += ch;
+            ++i;
+        }
+
+        // A class (or a single character) may be followed by '+', and must be the whole pattern then
+        bool single = set.empty() ? literal.size() == 1 : literal.empty();
+        if (i < pattern.size() && pattern[i] == '+' && single) {
+            m_runs = true;
+            ++i;
+        }
+        if (!set.empty() || m_runs) {
+            if (i != pattern.size() || !single) {
+                m_runs = false;
+                return false;
+            }
+        }
+    }
+
+    if (!set.empty()) {
+        m_delim = set;
+        m_type  = SplitView::Delimiter::AnyOf;
+    } else if (!literal.empty()) {
+        m_delim = literal;
+        m_type  = m_runs ? SplitView::Delimiter::AnyOf : SplitView::Delimiter::String;
+    } else {
+        return false;
+    }
+    return true;
+}
+
 template <typename Cnt>
 std::string implode(const Cnt& cnt, const std::string& delim)
 {
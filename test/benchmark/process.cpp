@@ -0,0 +1,218 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include "fty/process.h"
+#include <algorithm>
+#include <atomic>
+#include <catch2/catch.hpp>
+#include <fcntl.h>
+#include <thread>
+#include <vector>
+
+static const std::string HundredMb = "head -c 100000000 /dev/zero";
+
+TEST_CASE("Capture 100Mb", "[benchmark]")
+{
+    BENCHMARK("readAllStandardOutput()")
+    {
+        fty::Process process("sh", {"-c", HundredMb}, fty::Capture::Out);
+        process.run();
+        // Gives up as soon as the pipe is empty for a moment, so read until the child is gone
+        std::string out;
+        do {
+            out += process.readAllStandardOutput();
+        } while (!process.wait(0));
+        out += process.readAllStandardOutput();
+        return out.size();
+    };
+
+    std::string buffer;
+    BENCHMARK("readAllStandardOutput(buffer), reused buffer")
+    {
+        fty::Process process("sh", {"-c", HundredMb}, fty::Capture::Out);
+        process.run();
+        buffer.clear();
+        process.readAllStandardOutput(buffer);
+        process.wait();
+        return buffer.size();
+    };
+
+    int devNull = open("/dev/null", O_WRONLY);
+    BENCHMARK("spliceStandardOutput(), to /dev/null")
+    {
+        fty::Process process("sh", {"-c", HundredMb}, fty::Capture::Out);
+        process.run();
+        auto size = process.spliceStandardOutput(devNull);
+        process.wait();
+        return *size;
+    };
+    close(devNull);
+}
+
+TEST_CASE("Spawn latency", "[benchmark]")
+{
+    // Big heap and many open descriptors in the parent, where copying spawn would hurt
+    std::vector<char> ballast(256 * 1024 * 1024, 1);
+    std::vector<int>  fds;
+    for (int i = 0; i < 200; ++i) {
+        fds.push_back(open("/dev/null", O_RDONLY));
+    }
+
+    BENCHMARK("previous spawn path, inherited descriptors")
+    {
+        fty::Process     process("true");
+        fty::SpawnConfig config;
+        config.useVfork      = false;
+        config.closeOtherFds = false;
+        process.setSpawnConfig(config);
+        process.run();
+        return process.wait();
+    };
+
+    BENCHMARK("default SpawnConfig, closed descriptors")
+    {
+        fty::Process process("true");
+        process.run();
+        return process.wait();
+    };
+
+    for (int fd : fds) {
+        close(fd);
+    }
+    CHECK(ballast.size() > 0);
+}
+
+TEST_CASE("Spawn to exit", "[benchmark]")
+{
+    BENCHMARK("Process::run(true)")
+    {
+        return fty::Process::run("true", {});
+    };
+
+    std::string out;
+    BENCHMARK("Process::run(echo), captured output")
+    {
+        return fty::Process::run("echo", {"hello"}, out);
+    };
+
+    BENCHMARK("Process::run(sh -c true)")
+    {
+        return fty::Process::run("sh", {"-c", "true"});
+    };
+}
+
+TEST_CASE("Capture throughput", "[benchmark]")
+{
+    for (size_t size : {size_t(1024), size_t(64 * 1024), size_t(1024 * 1024), size_t(16 * 1024 * 1024)}) {
+        auto        cmd = fmt::format("head -c {} /dev/zero", size);
+        std::string out, err;
+
+        BENCHMARK(fmt::format("stdout {}Kb", size / 1024))
+        {
+            fty::Process process("sh", {"-c", cmd}, fty::Capture::Out | fty::Capture::Err);
+            process.run();
+            out.clear();
+            err.clear();
+            process.readAll(out, err);
+            process.wait();
+            return out.size();
+        };
+
+        BENCHMARK(fmt::format("stderr {}Kb", size / 1024))
+        {
+            fty::Process process("sh", {"-c", cmd + " >&2"}, fty::Capture::Out | fty::Capture::Err);
+            process.run();
+            out.clear();
+            err.clear();
+            process.readAll(out, err);
+            process.wait();
+            return err.size();
+        };
+    }
+}
+
+TEST_CASE("readFromFd per chunk", "[benchmark]")
+{
+    // Pipe holds 64Kb by default, so it is filled without a writer thread
+    static constexpr size_t pipeSize = 64 * 1024;
+
+    for (size_t chunk : {size_t(64), size_t(1024), size_t(16 * 1024)}) {
+        std::string data(chunk, 'x');
+        std::string output;
+
+        auto fill = [&]() {
+            int fds[2];
+            if (pipe(fds) != 0) {
+                return -1;
+            }
+            for (size_t written = 0; written < pipeSize; written += chunk) {
+                if (write(fds[1], data.data(), data.size()) != ssize_t(data.size())) {
+                    break;
+                }
+            }
+            close(fds[1]);
+            return fds[0];
+        };
+
+        BENCHMARK_ADVANCED(fmt::format("readFromFd(fd, ms), {} chunks of {}b", pipeSize / chunk, chunk))(Catch::Benchmark::Chronometer meter)
+        {
+            std::vector<int> fds(size_t(meter.runs()));
+            std::generate(fds.begin(), fds.end(), fill);
+            meter.measure([&](int i) {
+                return fty::readFromFd(fds[size_t(i)], 100).size();
+            });
+            std::for_each(fds.begin(), fds.end(), close);
+        };
+
+        BENCHMARK_ADVANCED(fmt::format("readFromFd(fd, buffer), {} chunks of {}b", pipeSize / chunk, chunk))(Catch::Benchmark::Chronometer meter)
+        {
+            std::vector<int> fds(size_t(meter.runs()));
+            std::generate(fds.begin(), fds.end(), fill);
+            meter.measure([&](int i) {
+                output.clear();
+                return *fty::readFromFd(fds[size_t(i)], output);
+            });
+            std::for_each(fds.begin(), fds.end(), close);
+        };
+    }
+}
+
+TEST_CASE("Concurrent spawns", "[benchmark]")
+{
+    static constexpr int spawnsPerThread = 20;
+
+    for (int threads : {1, 2, 4, 8}) {
+        BENCHMARK(fmt::format("{} threads x {} spawns", threads, spawnsPerThread))
+        {
+            std::vector<std::thread> workers;
+            std::atomic<int>         failed = 0;
+            for (int t = 0; t < threads; ++t) {
+                workers.emplace_back([&]() {
+                    for (int i = 0; i < spawnsPerThread; ++i) {
+                        auto ret = fty::Process::run("true", {});
+                        if (!ret || *ret != 0) {
+                            ++failed;
+                        }
+                    }
+                });
+            }
+            for (auto& worker : workers) {
+                worker.join();
+            }
+            return failed.load();
+        };
+    }
+}
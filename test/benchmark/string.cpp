@@ -0,0 +1,144 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include "fty/string-utils.h"
+#include <catch2/catch.hpp>
+#include <fmt/format.h>
+
+using fty::detail::ScanLevel;
+
+// CSV like text, about 4Mb
+static std::string csv()
+{
+    std::string text;
+    for (int i = 0; i < 100000; ++i) {
+        text += fmt::format("  ups{}, {} ,\tonline , {}.{} ;battery.charge\n", i, i * 7, i % 100, i % 10);
+    }
+    return text;
+}
+
+TEST_CASE("Scan kernels", "[benchmark]")
+{
+    std::string text = csv();
+    std::string blank(1 << 20, ' ');
+    blank.back() = 'x';
+
+    for (auto level : {ScanLevel::Scalar, ScanLevel::Sse2, ScanLevel::Avx2}) {
+        if (level > fty::detail::scanLevel()) {
+            continue;
+        }
+        const auto& kernels = fty::detail::scanKernels(level);
+        const char* name    = level == ScanLevel::Scalar ? "scalar" : level == ScanLevel::Sse2 ? "sse2" : "avx2";
+
+        BENCHMARK(fmt::format("findChar, {}", name))
+        {
+            size_t count = 0;
+            for (size_t pos = 0; pos < text.size(); ++count) {
+                pos += kernels.findChar(text.data() + pos, text.size() - pos, '\n') + 1;
+            }
+            return count;
+        };
+
+        BENCHMARK(fmt::format("findAnyOf, {}", name))
+        {
+            size_t count = 0;
+            for (size_t pos = 0; pos < text.size(); ++count) {
+                pos += kernels.findAnyOf(text.data() + pos, text.size() - pos, ";\n", 2) + 1;
+            }
+            return count;
+        };
+
+        BENCHMARK(fmt::format("skipSpace 1Mb, {}", name))
+        {
+            return kernels.skipSpace(blank.data(), blank.size());
+        };
+    }
+}
+
+TEST_CASE("Split lines", "[benchmark]")
+{
+    std::string text = csv();
+
+    BENCHMARK("split() to strings")
+    {
+        size_t count = 0;
+        for (const auto& line : fty::split(text, "\n")) {
+            count += fty::split(line, ",").size();
+        }
+        return count;
+    };
+
+    BENCHMARK("split() to views")
+    {
+        size_t                        count = 0;
+        std::vector<std::string_view> lines;
+        std::vector<std::string_view> fields;
+        for (auto line : fty::split(text, "\n", lines)) {
+            count += fty::split(line, ",", fields).size();
+        }
+        return count;
+    };
+
+    BENCHMARK("split() by set, to views")
+    {
+        size_t                        count = 0;
+        std::vector<std::string_view> lines;
+        std::vector<std::string_view> fields;
+        for (auto line : fty::split(text, "\n", lines)) {
+            count += fty::splitAnyOf(line, ",;", fields).size();
+        }
+        return count;
+    };
+
+    BENCHMARK("split() by multi-character delimiter")
+    {
+        return fty::split(text, " ,\t").size();
+    };
+
+    BENCHMARK("splitView(), first field")
+    {
+        size_t count = 0;
+        for (auto line : fty::splitView(text, "\n")) {
+            count += fty::splitView(line, ",").begin()->size();
+        }
+        return count;
+    };
+}
+
+TEST_CASE("Split regex", "[benchmark]")
+{
+    std::string line = "  ups0, 0 ,\tonline , 0.0 ;battery.charge";
+
+    BENCHMARK("std::regex per call")
+    {
+        return fty::split(line, std::regex("[,;]+")).size();
+    };
+
+    BENCHMARK("splitRegex(), simple pattern")
+    {
+        return fty::splitRegex(line, "[,;]+").size();
+    };
+
+    BENCHMARK("std::regex per call, with groups")
+    {
+        return fty::split(line, std::regex("(\\w+)\\s*,")).size();
+    };
+
+    BENCHMARK("splitRegex(), with groups")
+    {
+        return fty::splitRegex(line, "(\\w+)\\s*,").size();
+    };
+}
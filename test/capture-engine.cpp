@@ -0,0 +1,120 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+#include "fty/capture-engine.h"
+#include <catch2/catch.hpp>
+
+using Backend = fty::CaptureEngine::Backend;
+
+// io_uring may be disabled by seccomp or sysctl, Auto must fall back to epoll then
+static bool ioUringAvailable()
+{
+    io_uring_params params = {};
+    int             fd     = int(syscall(__NR_io_uring_setup, 1, &params));
+    if (fd == -1) {
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+TEST_CASE("Capture engine")
+{
+    auto backend = GENERATE(Backend::Auto, Backend::Epoll);
+
+    fty::CaptureEngine engine(backend, 4096);
+    if (backend == Backend::Epoll || !ioUringAvailable()) {
+        REQUIRE(engine.backend() == Backend::Epoll);
+    } else {
+        REQUIRE(engine.backend() == Backend::IoUring);
+    }
+
+    SECTION("Many children")
+    {
+        std::vector<std::unique_ptr<fty::Process>> processes;
+        std::vector<std::string>                   out(10);
+        std::vector<std::string>                   err(10);
+        for (size_t i = 0; i < 10; ++i) {
+            auto& proc = processes.emplace_back(std::make_unique<fty::Process>(
+                "sh", fty::Process::Arguments{"-c", fmt::format("echo out{}; echo err{} >&2", i, i)}));
+            REQUIRE(proc->run());
+            engine.add(*proc, out[i], err[i]);
+        }
+
+        REQUIRE(engine.run(5000));
+        for (size_t i = 0; i < 10; ++i) {
+            CHECK(out[i] == fmt::format("out{}\n", i));
+            CHECK(err[i] == fmt::format("err{}\n", i));
+            CHECK(*processes[i]->wait() == 0);
+        }
+    }
+
+    SECTION("Large output")
+    {
+        fty::Process proc("head", {"-c", "1000000", "/dev/zero"});
+        REQUIRE(proc.run());
+
+        std::string out, err;
+        engine.add(proc, out, err);
+        REQUIRE(engine.run());
+        CHECK(out.size() == 1000000);
+        CHECK(err.empty());
+        CHECK(*proc.wait() == 0);
+    }
+
+    SECTION("Timeout")
+    {
+        fty::Process proc("sh", {"-c", "echo begin; exec sleep 2"});
+        REQUIRE(proc.run());
+
+        std::string out, err;
+        engine.add(proc, out, err);
+        auto ret = engine.run(200);
+        REQUIRE(!ret);
+        CHECK(ret.error() == "timeout");
+        CHECK(out == "begin\n");
+        proc.kill();
+
+        // Engine is reusable after a timeout
+        fty::Process next("echo", {"next"});
+        REQUIRE(next.run());
+        std::string nextOut, nextErr;
+        engine.add(next, nextOut, nextErr);
+        REQUIRE(engine.run(5000));
+        CHECK(nextOut == "next\n");
+        CHECK(*next.wait() == 0);
+    }
+
+    SECTION("Read error")
+    {
+        // Pipe which never ends, its read is cancelled by the error of the closed descriptor
+        int open[2];
+        REQUIRE(pipe(open) == 0);
+        int closed[2];
+        REQUIRE(pipe(closed) == 0);
+        close(closed[0]);
+        close(closed[1]);
+
+        std::string out, bad;
+        engine.add(open[0], out);
+        engine.add(closed[0], bad);
+        auto ret = engine.run(5000);
+        REQUIRE(!ret);
+        CHECK(ret.error() != "timeout");
+
+        close(open[0]);
+        close(open[1]);
+    }
+}
@@ -0,0 +1,100 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+#include "fty/coprocess-pool.h"
+#include <catch2/catch.hpp>
+#include <thread>
+
+TEST_CASE("Coprocess pool")
+{
+    SECTION("Echo")
+    {
+        fty::CoprocessPool pool("cat", {}, 2);
+        for (int i = 0; i < 10; ++i) {
+            auto ret = pool.call(fmt::format("request {}\n", i), 1000);
+            REQUIRE(ret);
+            CHECK(fmt::format("request {}", i) == *ret);
+        }
+        CHECK(0 == pool.restarts());
+    }
+
+    SECTION("Concurrent")
+    {
+        fty::CoprocessPool       pool("cat", {}, 3);
+        std::vector<std::thread> threads;
+        std::atomic<int>         ok = 0;
+        for (int t = 0; t < 6; ++t) {
+            threads.emplace_back([&, t]() {
+                for (int i = 0; i < 20; ++i) {
+                    auto req = fmt::format("{}-{}", t, i);
+                    if (auto ret = pool.call(req + "\n", 1000); ret && *ret == req) {
+                        ++ok;
+                    }
+                }
+            });
+        }
+        for (auto& th : threads) {
+            th.join();
+        }
+        CHECK(120 == ok);
+    }
+
+    SECTION("Custom terminator")
+    {
+        fty::CoprocessPool pool("sh", {"-c", "while read a; do echo \"$a\"; echo \"$a\"; echo END; done"}, 1, "END\n");
+        auto               ret = pool.call("line\n", 1000);
+        REQUIRE(ret);
+        CHECK("line\nline\n" == *ret);
+    }
+
+    SECTION("Restart crashed helper")
+    {
+        fty::CoprocessPool pool("sh", {"-c", "read a; echo \"$a\""});
+
+        auto ret = pool.call("first\n", 1000);
+        REQUIRE(ret);
+        CHECK("first" == *ret);
+
+        // Helper exits after one request
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        CHECK(1 == pool.checkHealth());
+
+        auto ret2 = pool.call("second\n", 1000);
+        REQUIRE(ret2);
+        CHECK("second" == *ret2);
+        CHECK(1 == pool.restarts());
+    }
+
+    SECTION("Timeout")
+    {
+        fty::CoprocessPool pool("sh", {"-c", "read a; exec sleep 1000"});
+
+        auto ret = pool.call("request\n", 50);
+        CHECK(!ret);
+        CHECK("timeout" == ret.error());
+    }
+
+    SECTION("Helper not reading")
+    {
+        fty::CoprocessPool pool("sh", {"-c", "exec sleep 1000"});
+
+        // Request bigger than the pipe, the write times out
+        auto start = std::chrono::steady_clock::now();
+        auto ret   = pool.call(std::string(1024 * 1024, 'x'), 100);
+        CHECK(!ret);
+        CHECK("timeout" == ret.error());
+        CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(2));
+    }
+}
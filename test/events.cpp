@@ -133,3 +133,89 @@ TEST_CASE("Event thread")
 
     CHECK(42 == val);
 }
+
+TEST_CASE("Event priority")
+{
+    fty::Event<int> sig;
+    std::string     order;
+
+    fty::Slot<int> low([&](int) {
+        order += "l";
+    });
+    fty::Slot<int> normal([&](int) {
+        order += "n";
+    });
+    fty::Slot<int> normal2([&](int) {
+        order += "m";
+    });
+    fty::Slot<int> high([&](int) {
+        order += "h";
+    });
+
+    sig.connect(normal);
+    low.connect(sig, -10);
+    sig.connect(high, 10);
+    sig.connect(normal2);
+
+    sig(42);
+    CHECK("hnml" == order);
+}
+
+TEST_CASE("Event single shot")
+{
+    fty::Event<int> sig;
+    int             once   = 0;
+    int             always = 0;
+
+    fty::Slot<int> onceSlot([&](int) {
+        ++once;
+    });
+    fty::Slot<int> alwaysSlot([&](int) {
+        ++always;
+    });
+
+    sig.connect(onceSlot, 0, true);
+    sig.connect(alwaysSlot);
+
+    sig(1);
+    sig(2);
+    sig(3);
+    CHECK(once == 1);
+    CHECK(always == 3);
+
+    onceSlot.connect(sig, 0, true);
+    sig(4);
+    CHECK(once == 2);
+}
+
+TEST_CASE("Event statistics")
+{
+    using namespace std::chrono_literals;
+
+    fty::Event<int> sig("test-event");
+    fty::Slot<int>  slot([](int) {
+        std::this_thread::sleep_for(1ms);
+    });
+    sig.connect(slot);
+
+    sig(1);
+    sig(2);
+
+    auto stat = sig.statistics();
+#ifdef FTY_EVENT_PROFILING
+    CHECK("test-event" == stat.name);
+    CHECK(2 == stat.emitCount);
+    CHECK(1 == stat.listenerCount);
+    CHECK(stat.maxSlotTime >= 1ms);
+    CHECK(stat.slotsTime >= 2ms);
+
+    auto all = fty::eventStatistics();
+    CHECK(std::any_of(all.begin(), all.end(), [](const fty::EventStatistics& st) {
+        return st.name == "test-event";
+    }));
+#else
+    CHECK(stat.name.empty());
+    CHECK(0 == stat.emitCount);
+    CHECK(fty::eventStatistics().empty());
+#endif
+}
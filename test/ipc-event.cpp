@@ -0,0 +1,168 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+#include "fty/ipc-event.h"
+#include <catch2/catch.hpp>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+TEST_CASE("Ipc event")
+{
+    const std::string name = fmt::format("fty-utils-test-{}", getpid());
+
+    SECTION("Same process")
+    {
+        fty::IpcEvent<int, double> sig(name);
+        REQUIRE(sig.open());
+
+        fty::IpcEvent<int, double> listener(name);
+        REQUIRE(listener.open());
+
+        int                    count = 0;
+        fty::Slot<int, double> slot([&](int ival, double dval) {
+            ++count;
+            CHECK(ival == 42);
+            CHECK(dval == 4.2);
+        });
+        listener.connect(slot);
+
+        sig(42, 4.2);
+        CHECK(listener.wait(100));
+        CHECK(count == 1);
+
+        auto ret = listener.wait(10);
+        CHECK(!ret);
+        CHECK("timeout" == ret.error());
+        fty::IpcEvent<int, double>::unlink(name);
+    }
+
+    SECTION("Other process")
+    {
+        fty::IpcEvent<int> listener(name, 16);
+        REQUIRE(listener.open());
+
+        int            sum = 0;
+        fty::Slot<int> slot([&](int val) {
+            sum += val;
+        });
+        listener.connect(slot);
+
+        pid_t pid = fork();
+        REQUIRE(pid != -1);
+        if (pid == 0) {
+            fty::IpcEvent<int> sig(name);
+            if (!sig.open()) {
+                _exit(1);
+            }
+            for (int i = 1; i <= 3; ++i) {
+                sig(std::move(i));
+            }
+            _exit(0);
+        }
+
+        while (sum < 6 && listener.wait(1000)) {
+        }
+        CHECK(sum == 6);
+
+        int status = 0;
+        waitpid(pid, &status, 0);
+        CHECK(WEXITSTATUS(status) == 0);
+        fty::IpcEvent<int>::unlink(name);
+    }
+
+    SECTION("Overrun")
+    {
+        fty::IpcEvent<int> sig(name, 4);
+        REQUIRE(sig.open());
+
+        int            last  = 0;
+        int            count = 0;
+        fty::Slot<int> slot([&](int val) {
+            last = val;
+            ++count;
+        });
+        sig.connect(slot);
+
+        for (int i = 1; i <= 10; ++i) {
+            sig(std::move(i));
+        }
+        CHECK(sig.dispatch() == 4);
+        CHECK(count == 4);
+        CHECK(last == 10);
+        fty::IpcEvent<int>::unlink(name);
+    }
+
+    SECTION("Concurrent open")
+    {
+        // Everybody ends up on the same shared memory, whoever creates it
+        std::vector<std::unique_ptr<fty::IpcEvent<int>>> events;
+        std::vector<std::thread>                         threads;
+        std::atomic<int>                                 opened = 0;
+        for (int i = 0; i < 8; ++i) {
+            events.emplace_back(new fty::IpcEvent<int>(name));
+        }
+        for (auto& event : events) {
+            threads.emplace_back([&, ev = event.get()]() {
+                if (ev->open()) {
+                    ++opened;
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(8 == opened);
+
+        int            count = 0;
+        fty::Slot<int> slot([&](int) {
+            ++count;
+        });
+        for (auto& event : events) {
+            event->connect(slot);
+        }
+        (*events[0])(1);
+        for (auto& event : events) {
+            CHECK(1 == event->dispatch());
+        }
+        CHECK(8 == count);
+        fty::IpcEvent<int>::unlink(name);
+    }
+
+    SECTION("Stale shared memory")
+    {
+        // Left by creators which died before the size was set, and before the header was written
+        for (size_t size : {size_t(0), size_t(4096)}) {
+            int fd = shm_open(("/" + name).c_str(), O_RDWR | O_CREAT | O_EXCL, 0660);
+            REQUIRE(fd != -1);
+            REQUIRE(ftruncate(fd, off_t(size)) == 0);
+            close(fd);
+
+            fty::IpcEvent<int> sig(name);
+            REQUIRE(sig.open());
+
+            int            count = 0;
+            fty::Slot<int> slot([&](int) {
+                ++count;
+            });
+            sig.connect(slot);
+            sig(1);
+            CHECK(sig.dispatch() == 1);
+            CHECK(count == 1);
+            fty::IpcEvent<int>::unlink(name);
+        }
+    }
+}
@@ -0,0 +1,69 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+#include "fty/pipeline.h"
+#include "fty/string-utils.h"
+#include <catch2/catch.hpp>
+
+TEST_CASE("Pipeline")
+{
+    SECTION("Run")
+    {
+        std::string out;
+        auto        ret = fty::Pipeline::run({{"echo", "hello pipeline"}, {"tr", "a-z", "A-Z"}, {"cut", "-d", " ", "-f", "2"}}, out);
+        REQUIRE(ret);
+        CHECK(std::vector<int>{0, 0, 0} == *ret);
+        CHECK("PIPELINE\n" == out);
+    }
+
+    SECTION("Stage exit codes")
+    {
+        fty::Pipeline pipeline;
+        pipeline.add("sh", {"-c", "echo hello; exit 3"}).add("cat").add("sh", {"-c", "cat; echo error >&2; exit 5"});
+        REQUIRE(pipeline.run());
+
+        std::string out, err;
+        REQUIRE(pipeline.last().readAll(out, err, 5000));
+        CHECK("hello\n" == out);
+        CHECK("error\n" == err);
+
+        auto codes = pipeline.wait();
+        REQUIRE(codes);
+        CHECK(std::vector<int>{3, 0, 5} == *codes);
+    }
+
+    SECTION("Write to the pipeline")
+    {
+        fty::Pipeline pipeline(fty::Capture::In | fty::Capture::Out);
+        pipeline.add("cat").add("wc", {"-l"});
+        REQUIRE(pipeline.run());
+
+        CHECK(pipeline.first().write("one\ntwo\nthree\n"));
+        pipeline.first().closeWriteChannel();
+
+        std::string out;
+        REQUIRE(pipeline.last().readAllStandardOutput(out, 5000));
+        CHECK("3" == fty::trimmed(out));
+        REQUIRE(pipeline.wait());
+    }
+
+    SECTION("Invalid stage")
+    {
+        fty::Pipeline pipeline;
+        pipeline.add("echo", {"hello"}).add("/usr/bin/bad");
+        auto ret = pipeline.run();
+        CHECK(!ret);
+    }
+}
@@ -0,0 +1,87 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+#include "fty/process-batch.h"
+#include <catch2/catch.hpp>
+
+TEST_CASE("Process batch")
+{
+    SECTION("Results in order")
+    {
+        fty::ProcessBatch batch(3);
+        for (int i = 0; i < 10; ++i) {
+            batch.add("sh", {"-c", fmt::format("sleep 0.0{}; echo out{}; echo err{} >&2; exit {}", 9 - i, i, i, i)});
+        }
+
+        size_t finished = 0;
+        fty::Slot<size_t> slot([&](size_t) {
+            ++finished;
+        });
+        batch.commandFinished.connect(slot);
+
+        REQUIRE(batch.run());
+        CHECK(finished == 10);
+        REQUIRE(batch.results().size() == 10);
+        for (int i = 0; i < 10; ++i) {
+            const auto& result = batch.results()[size_t(i)];
+            CHECK(result.finished);
+            CHECK(result.error.empty());
+            CHECK(result.exitCode == i);
+            CHECK(fmt::format("out{}\n", i) == result.out);
+            CHECK(fmt::format("err{}\n", i) == result.err);
+            CHECK(result.usage.wallTime > std::chrono::microseconds(0));
+        }
+    }
+
+    SECTION("Concurrency limit")
+    {
+        fty::ProcessBatch batch(2);
+        for (int i = 0; i < 6; ++i) {
+            batch.add("sleep", {"0.2"});
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        REQUIRE(batch.run());
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        // Three rounds of two
+        CHECK(elapsed >= std::chrono::milliseconds(600));
+        CHECK(elapsed < std::chrono::milliseconds(1100));
+    }
+
+    SECTION("Large output")
+    {
+        fty::ProcessBatch batch(2);
+        batch.add("head", {"-c", "1000000", "/dev/zero"}).add("head", {"-c", "500000", "/dev/zero"});
+        REQUIRE(batch.run());
+        CHECK(batch.results()[0].out.size() == 1000000);
+        CHECK(batch.results()[1].out.size() == 500000);
+    }
+
+    SECTION("Failures")
+    {
+        fty::ProcessBatch batch(2);
+        batch.add("not-existing-command").add("sh", {"-c", "exec sleep 1000"}).add("echo", {"ok"});
+        REQUIRE(batch.run(200));
+
+        const auto& results = batch.results();
+        CHECK(!results[0].finished);
+        CHECK(!results[0].error.empty());
+        CHECK(!results[1].finished);
+        CHECK("timeout" == results[1].error);
+        CHECK(results[2].finished);
+        CHECK("ok\n" == results[2].out);
+    }
+}
@@ -0,0 +1,135 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+#include "fty/process-cache.h"
+#include <catch2/catch.hpp>
+#include <thread>
+
+TEST_CASE("Process cache")
+{
+    // Every run prints something new
+    const std::string unique = "date +%s%N";
+
+    SECTION("Hit")
+    {
+        fty::ProcessCache cache;
+
+        std::string first, second;
+        REQUIRE(cache.run("sh", {"-c", unique}, first));
+        REQUIRE(cache.run("sh", {"-c", unique}, second));
+        CHECK(first == second);
+
+        std::string other;
+        REQUIRE(cache.run("sh", {"-c", unique + "; true"}, other));
+        CHECK(first != other);
+
+        auto stat = cache.statistics();
+        CHECK(stat.hits == 1);
+        CHECK(stat.misses == 2);
+        CHECK(cache.size() == 2);
+    }
+
+    SECTION("Exit code and errors")
+    {
+        fty::ProcessCache cache;
+
+        std::string out;
+        auto        ret = cache.run("sh", {"-c", "echo -n failed; exit 3"}, out);
+        REQUIRE(ret);
+        CHECK(*ret == 3);
+        CHECK("failed" == out);
+
+        auto cached = cache.run("sh", {"-c", "echo -n failed; exit 3"}, out);
+        REQUIRE(cached);
+        CHECK(*cached == 3);
+        CHECK(cache.statistics().hits == 1);
+
+        // Not cached
+        CHECK(!cache.run("not-existing-command", {}, out));
+        CHECK(!cache.run("not-existing-command", {}, out));
+        CHECK(cache.statistics().misses == 3);
+    }
+
+    SECTION("TTL")
+    {
+        fty::ProcessCache cache(std::chrono::milliseconds(100));
+
+        std::string first, second;
+        REQUIRE(cache.run("sh", {"-c", unique}, first));
+        std::this_thread::sleep_for(std::chrono::milliseconds(150));
+        REQUIRE(cache.run("sh", {"-c", unique}, second));
+        CHECK(first != second);
+        CHECK(cache.statistics().misses == 2);
+    }
+
+    SECTION("Size bound")
+    {
+        fty::ProcessCache cache(std::chrono::seconds(10), 2);
+
+        std::string out;
+        REQUIRE(cache.run("echo", {"1"}, out));
+        REQUIRE(cache.run("echo", {"2"}, out));
+        REQUIRE(cache.run("echo", {"1"}, out));
+        // Drops "2", least recently used
+        REQUIRE(cache.run("echo", {"3"}, out));
+        CHECK(cache.size() == 2);
+        CHECK(cache.statistics().evictions == 1);
+
+        REQUIRE(cache.run("echo", {"1"}, out));
+        CHECK(cache.statistics().hits == 2);
+        REQUIRE(cache.run("echo", {"2"}, out));
+        CHECK(cache.statistics().misses == 4);
+    }
+
+    SECTION("Environment")
+    {
+        fty::ProcessCache cache(std::chrono::seconds(10), 16, {"FTY_CACHE_TEST"});
+
+        std::string out;
+        setenv("FTY_CACHE_TEST", "one", 1);
+        REQUIRE(cache.run("sh", {"-c", "echo -n $FTY_CACHE_TEST"}, out));
+        CHECK("one" == out);
+
+        setenv("FTY_CACHE_TEST", "two", 1);
+        REQUIRE(cache.run("sh", {"-c", "echo -n $FTY_CACHE_TEST"}, out));
+        CHECK("two" == out);
+        unsetenv("FTY_CACHE_TEST");
+
+        CHECK(cache.statistics().misses == 2);
+    }
+
+    SECTION("Coalescing")
+    {
+        fty::ProcessCache cache;
+
+        std::vector<std::string> outs(8);
+        std::vector<std::thread> threads;
+        for (auto& out : outs) {
+            threads.emplace_back([&]() {
+                cache.run("sh", {"-c", "sleep 0.2; " + unique}, out);
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        for (const auto& out : outs) {
+            CHECK(outs[0] == out);
+        }
+        auto stat = cache.statistics();
+        CHECK(stat.misses == 1);
+        CHECK(stat.coalesced + stat.hits == 7);
+    }
+}
@@ -0,0 +1,112 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+#include "fty/process-coroutine.h"
+#include <catch2/catch.hpp>
+
+// Built as C++20 on its own, see CMakeLists.txt
+
+TEST_CASE("Process coroutine")
+{
+    fty::ProcessReactor reactor;
+
+    SECTION("Execute")
+    {
+        auto ret = reactor.run(reactor.execute("sh", {"-c", "echo out; echo err >&2; exit 4"}));
+        REQUIRE(ret);
+        CHECK(4 == ret->exitCode);
+        CHECK("out\n" == ret->out);
+        CHECK("err\n" == ret->err);
+
+        CHECK(!reactor.run(reactor.execute("not-existing-command")));
+    }
+
+    SECTION("Chunks and exit")
+    {
+        auto task = [&]() -> fty::Task<fty::Expected<std::vector<std::string>>> {
+            fty::Process process("sh", {"-c", "echo -n first; sleep 0.1; echo -n second; exit 2"}, fty::Capture::Out);
+            if (auto ret = process.run(); !ret) {
+                co_return fty::unexpected(ret.error());
+            }
+
+            std::vector<std::string> chunks;
+            while (true) {
+                auto chunk = co_await reactor.read(process);
+                if (!chunk) {
+                    co_return fty::unexpected(chunk.error());
+                }
+                if (chunk->empty()) {
+                    break;
+                }
+                chunks.push_back(*chunk);
+            }
+
+            auto code = co_await reactor.exited(process);
+            if (!code || *code != 2) {
+                co_return fty::unexpected("wrong exit code");
+            }
+            co_return chunks;
+        };
+
+        auto chunks = reactor.run(task());
+        REQUIRE(chunks);
+        CHECK(std::vector<std::string>{"first", "second"} == *chunks);
+    }
+
+    SECTION("Abandoned output")
+    {
+        // Pipes read partially, then forgotten, their descriptor numbers are reused by the next process
+        for (int i = 0; i < 3; ++i) {
+            auto task = [&]() -> fty::Task<fty::Expected<std::string>> {
+                fty::Process process("sh", {"-c", "echo -n first; sleep 0.1; echo -n second"}, fty::Capture::Out);
+                if (auto ret = process.run(); !ret) {
+                    co_return fty::unexpected(ret.error());
+                }
+                auto chunk = co_await reactor.read(process);
+                reactor.detach(process);
+                co_return chunk;
+            };
+
+            auto chunk = reactor.run(task());
+            REQUIRE(chunk);
+            CHECK("first" == *chunk);
+
+            auto ret = reactor.run(reactor.execute("echo", {"next"}));
+            REQUIRE(ret);
+            CHECK("next\n" == ret->out);
+        }
+    }
+
+    SECTION("Many children, one thread")
+    {
+        int  finished = 0;
+        auto sleeper  = [&]() -> fty::Task<> {
+            fty::Process::Arguments args = {"0.2"};
+            auto                    ret  = co_await reactor.execute("sleep", args);
+            if (ret && ret->exitCode == 0) {
+                ++finished;
+            }
+        };
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 20; ++i) {
+            reactor.spawn(sleeper());
+        }
+        reactor.run();
+
+        CHECK(20 == finished);
+        CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(2));
+    }
+}
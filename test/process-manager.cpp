@@ -0,0 +1,200 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+#include "fty/process-manager.h"
+#include <catch2/catch.hpp>
+#include <fstream>
+#include <future>
+#include <thread>
+
+TEST_CASE("Process manager")
+{
+    fty::ProcessManager manager;
+
+    SECTION("Exit code")
+    {
+        fty::Process proc("sh", {"-c", "exit 3"}, fty::Capture::None);
+        REQUIRE(proc.run());
+
+        auto child = manager.watch(proc);
+        REQUIRE(child);
+        CHECK(!proc.wait());
+
+        auto status = (*child)->wait(1000);
+        REQUIRE(status);
+        CHECK(3 == *status);
+        CHECK((*child)->isFinished());
+        CHECK(0 == manager.count());
+    }
+
+    SECTION("Output")
+    {
+        fty::Process proc("echo", {"-n", "hello"});
+        REQUIRE(proc.run());
+
+        auto child = manager.watch(proc);
+        REQUIRE(child);
+        REQUIRE((*child)->wait(1000));
+        CHECK("hello" == proc.readAllStandardOutput());
+    }
+
+    SECTION("Many children")
+    {
+        std::vector<std::unique_ptr<fty::Process>> procs;
+        std::vector<fty::ProcessManager::ChildPtr>  children;
+        std::atomic<int>                            finished = 0;
+
+        fty::Slot<pid_t, int> onFinish([&](pid_t, int code) {
+            CHECK(0 == code);
+            ++finished;
+        });
+        manager.finished.connect(onFinish);
+
+        for (int i = 0; i < 50; ++i) {
+            auto& proc = procs.emplace_back(new fty::Process("true", {}, fty::Capture::None));
+            REQUIRE(proc->run());
+            auto child = manager.watch(*proc);
+            REQUIRE(child);
+            children.push_back(*child);
+        }
+
+        for (auto& child : children) {
+            auto status = child->wait(5000);
+            REQUIRE(status);
+            CHECK(0 == *status);
+        }
+        // Slots are called after the child is finished, wait() can return before them
+        for (int i = 0; i < 500 && finished < 50; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        CHECK(50 == finished);
+        CHECK(0 == manager.count());
+    }
+
+    SECTION("Wait from slot")
+    {
+        fty::Process proc("sleep", {"0.2"}, fty::Capture::None);
+        REQUIRE(proc.run());
+
+        auto child = manager.watch(proc);
+        REQUIRE(child);
+
+        std::promise<int> slotStatus;
+        fty::Slot<int>    onFinish([&](int) {
+            auto status = (*child)->wait();
+            slotStatus.set_value(status ? *status : -1);
+        });
+        (*child)->finished.connect(onFinish);
+
+        auto future = slotStatus.get_future();
+        REQUIRE(future.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+        CHECK(0 == future.get());
+    }
+
+    SECTION("Timeout")
+    {
+        fty::Process proc("sleep", {"100"}, fty::Capture::None);
+        REQUIRE(proc.run());
+
+        auto child = manager.watch(proc, 50);
+        REQUIRE(child);
+        CHECK(!(*child)->wait(10));
+
+        auto status = (*child)->wait(5000);
+        CHECK(!status);
+        CHECK("killed by timeout" == status.error());
+        CHECK((*child)->isFinished());
+    }
+
+    SECTION("Terminate gracefully")
+    {
+        fty::Process proc("sleep", {"100"}, fty::Capture::None);
+        REQUIRE(proc.run());
+
+        auto start = std::chrono::steady_clock::now();
+        auto child = manager.terminate(proc);
+        REQUIRE(child);
+        CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(100));
+
+        auto status = (*child)->wait(5000);
+        REQUIRE(status);
+        CHECK(SIGTERM == *status);
+    }
+
+    SECTION("Escalate to SIGKILL")
+    {
+        fty::Process proc("sh", {"-c", "trap '' TERM INT; echo ready; while true; do sleep 0.05; done"}, fty::Capture::Out);
+        REQUIRE(proc.run());
+        CHECK("ready\n" == proc.readAllStandardOutput(5000).substr(0, 6));
+
+        fty::TerminationPolicy policy;
+        policy.grace = std::chrono::milliseconds(200);
+
+        auto child = manager.watch(proc);
+        REQUIRE(child);
+
+        auto start = std::chrono::steady_clock::now();
+        manager.terminate(*child, policy);
+        CHECK(!(*child)->wait(100));
+
+        auto status = (*child)->wait(5000);
+        REQUIRE(status);
+        CHECK(SIGKILL == *status);
+        CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(200));
+    }
+
+    SECTION("Process group on timeout")
+    {
+        // Grandchild ignores SIGTERM and would survive its parent
+        fty::Process proc("sh", {"-c", "(trap '' TERM; exec sleep 100) & echo $!; wait"}, fty::Capture::Out);
+        fty::SpawnConfig config;
+        config.processGroup = 0;
+        proc.setSpawnConfig(config);
+        REQUIRE(proc.run());
+
+        std::string out;
+        auto        deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (out.find('\n') == std::string::npos && std::chrono::steady_clock::now() < deadline) {
+            out += proc.readAllStandardOutput(100);
+        }
+        pid_t grandchild = std::stoi(out);
+        REQUIRE(grandchild > 0);
+
+        fty::TerminationPolicy policy;
+        policy.grace        = std::chrono::milliseconds(200);
+        policy.processGroup = true;
+
+        auto child = manager.watch(proc, 50, policy);
+        REQUIRE(child);
+
+        auto status = (*child)->wait(5000);
+        CHECK(!status);
+        CHECK("killed by timeout" == status.error());
+
+        // Grandchild is killed with its group. It is reaped by init, if init reaps at all: zombie is fine.
+        auto isGone = [&]() {
+            std::ifstream stat(fmt::format("/proc/{}/stat", grandchild));
+            std::string   line;
+            return !std::getline(stat, line) || line.find(") Z ") != std::string::npos;
+        };
+
+        bool gone = false;
+        for (int i = 0; i < 100 && !gone; ++i) {
+            gone = isGone();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        CHECK(gone);
+    }
+}
@@ -131,6 +131,329 @@ TEST_CASE("Process")
         CHECK(*ret2 == 0);
     }
 
+    SECTION("Run process static, output kept open in background")
+    {
+        // Background sleep holds the pipes after the shell exits
+        std::string out, err;
+        auto        start = std::chrono::steady_clock::now();
+        auto        ret   = fty::Process::run("sh", {"-c", "sleep 100 & echo $!"}, out, err);
+        REQUIRE(ret);
+        CHECK(*ret == 0);
+        CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+        ::kill(std::stoi(out), SIGKILL);
+
+        out.clear();
+        start = std::chrono::steady_clock::now();
+        auto ret2 = fty::Process::run("sh", {"-c", "sleep 100 & echo $!"}, out);
+        REQUIRE(ret2);
+        CHECK(*ret2 == 0);
+        CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+        ::kill(std::stoi(out), SIGKILL);
+    }
+
+    SECTION("Move")
+    {
+        std::vector<fty::Process> processes;
+        processes.push_back(fty::Process("echo", {"-n", "first"}));
+        processes.push_back(fty::Process("echo", {"-n", "second"}));
+        for (auto& process : processes) {
+            REQUIRE(process.run());
+        }
+
+        fty::Process moved = std::move(processes[1]);
+        CHECK(!processes[1].exists());
+
+        // Previous child of the target is released, killed if still running
+        processes[1] = fty::Process("sh", {"-c", "exec sleep 1000"});
+        REQUIRE(processes[1].run());
+        processes[1] = std::move(moved);
+
+        std::string out;
+        REQUIRE(processes[0].readAllStandardOutput(out, 5000));
+        CHECK("first" == out);
+        out.clear();
+        REQUIRE(processes[1].readAllStandardOutput(out, 5000));
+        CHECK("second" == out);
+        CHECK(*processes[0].wait() == 0);
+        CHECK(*processes[1].wait() == 0);
+    }
+
+}
+
+TEST_CASE("Environment")
+{
+    SECTION("Shared snapshot")
+    {
+        auto env1 = fty::Environment::current();
+        auto env2 = fty::Environment::current();
+        CHECK(env1 == env2);
+
+        setenv("FTY_UTILS_TEST_VAR", "value", 1);
+        auto env3 = fty::Environment::current();
+        CHECK(env1 != env3);
+        CHECK(std::find(env3->entries().begin(), env3->entries().end(), "FTY_UTILS_TEST_VAR=value") != env3->entries().end());
+        unsetenv("FTY_UTILS_TEST_VAR");
+    }
+
+    SECTION("Override existing variable")
+    {
+        setenv("FTY_UTILS_TEST_VAR", "original", 1);
+        auto process = fty::Process("sh", {"-c", "echo -n $FTY_UTILS_TEST_VAR"});
+        process.setEnvVar("FTY_UTILS_TEST_VAR", "first");
+        process.setEnvVar("FTY_UTILS_TEST_VAR", "overridden");
+        unsetenv("FTY_UTILS_TEST_VAR");
+
+        REQUIRE(process.run());
+        std::string out;
+        REQUIRE(process.readAllStandardOutput(out, 5000));
+        CHECK("overridden" == out);
+        REQUIRE(process.wait());
+    }
+
+    SECTION("Custom environment")
+    {
+        auto process = fty::Process("/usr/bin/env", {}, fty::Capture::Out);
+        process.setEnvironment(std::make_shared<fty::Environment>(std::vector<std::string>{"ONLY=one"}));
+        process.setEnvVar("OTHER", "two");
+
+        REQUIRE(process.run());
+        std::string out;
+        REQUIRE(process.readAllStandardOutput(out, 5000));
+        CHECK("ONLY=one\nOTHER=two\n" == out);
+        REQUIRE(process.wait());
+    }
+}
+
+TEST_CASE("Spawn config")
+{
+    SECTION("Close other descriptors")
+    {
+        int fds[2];
+        REQUIRE(pipe(fds) == 0);
+        auto check = fmt::format("test -e /proc/self/fd/{} && echo -n open || echo -n closed", fds[0]);
+
+        std::string out;
+        REQUIRE(fty::Process::run("sh", {"-c", check}, out));
+        CHECK("closed" == out);
+
+        auto process = fty::Process("sh", {"-c", check}, fty::Capture::Out);
+        fty::SpawnConfig config;
+        config.closeOtherFds = false;
+        process.setSpawnConfig(config);
+        REQUIRE(process.run());
+        out.clear();
+        REQUIRE(process.readAllStandardOutput(out, 5000));
+        CHECK("open" == out);
+        REQUIRE(process.wait());
+
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    SECTION("Process group")
+    {
+        auto             process = fty::Process("sh", {"-c", "echo -n $(($(ps -o pgid= $$)))"}, fty::Capture::Out);
+        fty::SpawnConfig config;
+        config.processGroup = 0;
+        process.setSpawnConfig(config);
+
+        auto pid = process.run();
+        REQUIRE(pid);
+        std::string out;
+        REQUIRE(process.readAllStandardOutput(out, 5000));
+        CHECK(std::to_string(*pid) == out);
+        REQUIRE(process.wait());
+    }
+
+    SECTION("Signal mask")
+    {
+        auto             process = fty::Process("grep", {"SigBlk", "/proc/self/status"}, fty::Capture::Out);
+        fty::SpawnConfig config;
+        sigset_t         mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGUSR1);
+        config.signalMask = mask;
+        process.setSpawnConfig(config);
+
+        REQUIRE(process.run());
+        std::string out;
+        REQUIRE(process.readAllStandardOutput(out, 5000));
+        // SIGUSR1 is signal 10, bit 9
+        CHECK(out.find("0000000000000200") != std::string::npos);
+        REQUIRE(process.wait());
+    }
+}
+
+TEST_CASE("Resource usage")
+{
+    // Burns some CPU in the child, wall time covers the sleep too
+    auto process = fty::Process("sh", {"-c", "i=0; while [ $i -lt 20000 ]; do i=$((i+1)); done; sleep 0.2"});
+    REQUIRE(process.run());
+
+    fty::ResourceUsage usage;
+    auto               ret = process.wait(usage);
+    REQUIRE(ret);
+    CHECK(*ret == 0);
+    CHECK(usage.wallTime >= std::chrono::milliseconds(200));
+    CHECK(usage.userTime + usage.systemTime > std::chrono::microseconds(0));
+    CHECK(usage.maxRss > 0);
+    CHECK(usage.voluntarySwitches > 0);
+
+    CHECK(!process.wait(usage));
+}
+
+TEST_CASE("Write async")
+{
+    SECTION("Large input while reading output")
+    {
+        // Blocking write would deadlock: cat stalls on its full output pipe while we are still writing
+        auto process = fty::Process("cat", {}, fty::Capture::In | fty::Capture::Out | fty::Capture::Err);
+        REQUIRE(process.run());
+
+        std::string input(4 * 1024 * 1024, 'x');
+        process.setInputBufferSize(input.size());
+        REQUIRE(process.writeAsync(input));
+        CHECK(process.pendingInput() > 0);
+        process.closeWriteChannel();
+
+        std::string out, err;
+        REQUIRE(process.readAll(out, err, 10000));
+        CHECK(process.pendingInput() == 0);
+        CHECK(input == out);
+        CHECK(*process.wait() == 0);
+    }
+
+    SECTION("Closed, then read with single stream readers")
+    {
+        // Deferred close, the readers write the queue while waiting for the output
+        std::string input(1024 * 1024, 'x');
+        for (int i = 0; i < 2; ++i) {
+            auto process = fty::Process("cat", {}, fty::Capture::In | fty::Capture::Out);
+            REQUIRE(process.run());
+
+            process.setInputBufferSize(input.size());
+            REQUIRE(process.writeAsync(input));
+            CHECK(process.pendingInput() > 0);
+            process.closeWriteChannel();
+
+            std::string out;
+            if (i == 0) {
+                REQUIRE(process.readAllStandardOutput(out, 10000));
+            } else {
+                out = process.readAllStandardOutput();
+            }
+            CHECK(process.pendingInput() == 0);
+            CHECK(input == out);
+            CHECK(*process.wait() == 0);
+        }
+    }
+
+    SECTION("Many small messages")
+    {
+        auto process = fty::Process("cat", {}, fty::Capture::In | fty::Capture::Out);
+        REQUIRE(process.run());
+
+        std::string expected;
+        bool        written = true;
+        for (int i = 0; i < 10000 && written; ++i) {
+            auto line = fmt::format("message {}\n", i);
+            expected += line;
+            written = bool(process.writeAsync(line, 5000));
+        }
+        REQUIRE(written);
+        process.closeWriteChannel();
+
+        std::string out, err;
+        REQUIRE(process.readAll(out, err, 5000));
+        CHECK(expected == out);
+        CHECK(*process.wait() == 0);
+    }
+
+    SECTION("Backpressure")
+    {
+        auto process = fty::Process("sh", {"-c", "exec sleep 1000"}, fty::Capture::In);
+        REQUIRE(process.run());
+        process.setInputBufferSize(1000);
+
+        // Bigger than the queue, accepted as the queue is empty; the pipe takes only part of it
+        REQUIRE(process.writeAsync(std::string(1024 * 1024, 'x')));
+        CHECK(process.pendingInput() > 0);
+
+        auto ret = process.writeAsync("x", 100);
+        REQUIRE(!ret);
+        CHECK("timeout" == ret.error());
+
+        process.kill();
+    }
+
+    SECTION("Wait with queued input")
+    {
+        auto process = fty::Process("sh", {"-c", "exec sleep 1000"}, fty::Capture::In);
+        REQUIRE(process.run());
+        REQUIRE(process.writeAsync(std::string(1024 * 1024, 'x')));
+        CHECK(process.pendingInput() > 0);
+
+        // One timeout for the input and the child together
+        auto start = std::chrono::steady_clock::now();
+        auto ret   = process.wait(200);
+        REQUIRE(!ret);
+        CHECK("timeout" == ret.error());
+        CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(350));
+
+        process.kill();
+    }
+
+    SECTION("Not captured")
+    {
+        auto process = fty::Process("true", {}, fty::Capture::Out);
+        REQUIRE(process.run());
+        CHECK(!process.writeAsync("data"));
+        CHECK(*process.wait() == 0);
+    }
+}
+
+TEST_CASE("Capture large output")
+{
+    SECTION("In memory")
+    {
+        auto process = fty::Process("echo", {"hello"}, fty::Capture::Out);
+        REQUIRE(process.run());
+
+        auto output = process.captureStandardOutput(1000, 5000);
+        REQUIRE(output);
+        CHECK(!output->isMapped());
+        CHECK("hello\n" == output->view());
+        CHECK(*process.wait() == 0);
+    }
+
+    SECTION("Spilled")
+    {
+        auto process = fty::Process("sh", {"-c", "head -c 3000000 /dev/zero | tr '\\0' a"}, fty::Capture::Out);
+        REQUIRE(process.run());
+
+        auto output = process.captureStandardOutput(1000, 5000);
+        REQUIRE(output);
+        CHECK(output->isMapped());
+        REQUIRE(output->size() == 3000000);
+        CHECK(output->view().find_first_not_of('a') == std::string_view::npos);
+        CHECK(*process.wait() == 0);
+
+        // Mapping moves with the object
+        fty::CapturedOutput moved = std::move(*output);
+        CHECK(moved.size() == 3000000);
+        CHECK(moved.view().back() == 'a');
+    }
+
+    SECTION("Timeout")
+    {
+        auto process = fty::Process("sh", {"-c", "head -c 5000 /dev/zero; exec sleep 1000"}, fty::Capture::Out);
+        REQUIRE(process.run());
+
+        auto output = process.captureStandardOutput(1000, 100);
+        REQUIRE(!output);
+        CHECK("timeout" == output.error());
+        process.kill();
+    }
 }
 
 TEST_CASE("Write process 2")
@@ -145,6 +468,102 @@ TEST_CASE("Write process 2")
     CHECK("hello2" == fty::trimmed(process.readAllStandardOutput()));
 }
 
+TEST_CASE("Read all")
+{
+    SECTION("Both streams")
+    {
+        std::string out, err;
+        // Fill stderr pipe way over its capacity while stdout stays open
+        auto ret = fty::Process::run("sh", {"-c", "head -c 1000000 /dev/zero | tr '\\0' e >&2; echo -n done"}, out, err);
+        REQUIRE(ret);
+        CHECK(*ret == 0);
+        CHECK(out == "done");
+        CHECK(err.size() == 1000000);
+        CHECK(err.find_first_not_of('e') == std::string::npos);
+    }
+
+    SECTION("Timeout")
+    {
+        // exec, killing the shell would leave sleep running
+        auto process = fty::Process("sh", {"-c", "echo -n hello; exec sleep 1000"});
+        REQUIRE(process.run());
+
+        std::string out, err;
+        auto        ret = process.readAll(out, err, 100);
+        CHECK(!ret);
+        CHECK("timeout" == ret.error());
+        CHECK(out == "hello");
+    }
+}
+
+TEST_CASE("Stream")
+{
+    auto process = fty::Process("sh", {"-c", "echo first; echo -n sec; sleep 0.1; echo ond; echo err >&2; echo -n last"});
+
+    std::vector<std::string> lines;
+    std::vector<std::string> errLines;
+    size_t                   size = 0;
+
+    fty::Slot<std::string_view> onLine([&](std::string_view line) {
+        lines.emplace_back(line);
+    });
+    fty::Slot<std::string_view> onErrLine([&](std::string_view line) {
+        errLines.emplace_back(line);
+    });
+    fty::Slot<std::string_view> onData([&](std::string_view data) {
+        size += data.size();
+    });
+    process.outputLine().connect(onLine);
+    process.errorLine().connect(onErrLine);
+    process.outputData().connect(onData);
+
+    REQUIRE(process.run());
+    REQUIRE(process.stream(5000));
+    CHECK(std::vector<std::string>{"first", "second", "last"} == lines);
+    CHECK(std::vector<std::string>{"err"} == errLines);
+    CHECK(size == 17);
+
+    auto status = process.wait();
+    REQUIRE(status);
+    CHECK(*status == 0);
+}
+
+TEST_CASE("Read to buffer")
+{
+    std::string buffer;
+    for (int i = 0; i < 2; ++i) {
+        auto process = fty::Process("sh", {"-c", "head -c 300000 /dev/zero"});
+        REQUIRE(process.run());
+
+        buffer.clear();
+        auto size = process.readAllStandardOutput(buffer, 5000);
+        REQUIRE(size);
+        CHECK(*size == 300000);
+        CHECK(buffer.size() == 300000);
+        REQUIRE(process.wait());
+    }
+
+    SECTION("Splice")
+    {
+        char tmpl[] = "/tmp/fty-utils-splice-XXXXXX";
+        int  fd     = mkstemp(tmpl);
+        REQUIRE(fd != -1);
+        unlink(tmpl);
+
+        auto process = fty::Process("echo", {"-n", "hello"});
+        REQUIRE(process.run());
+        auto size = process.spliceStandardOutput(fd, 5000);
+        REQUIRE(size);
+        CHECK(*size == 5);
+        REQUIRE(process.wait());
+
+        std::string content(5, '\0');
+        CHECK(pread(fd, content.data(), content.size(), 0) == 5);
+        CHECK("hello" == content);
+        close(fd);
+    }
+}
+
 TEST_CASE("Huge")
 {
     auto process = fty::Process("dpkg", {"-l"});
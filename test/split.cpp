@@ -14,7 +14,10 @@
     ========================================================================
 */
 #include "fty/string-utils.h"
+#include <atomic>
 #include <catch2/catch.hpp>
+#include <fmt/format.h>
+#include <thread>
 
 
 TEST_CASE("Split utils")
@@ -48,6 +51,108 @@ TEST_CASE("Split utils")
         CHECK(std::vector<std::string>{"Norwegian    ", "    Blue"} == vec2);
     }
 
+    SECTION("Views")
+    {
+        std::string                   str = "Norwegian    ,    Blue,,  ";
+        std::vector<std::string_view> out;
+
+        fty::split(str, ",", out);
+        CHECK(std::vector<std::string_view>{"Norwegian", "Blue", ""} == out);
+        CHECK(out[0].data() == str.data());
+
+        fty::split(str, ",", out, fty::SplitOption::KeepEmpty | fty::SplitOption::NoTrim);
+        CHECK(std::vector<std::string_view>{"Norwegian    ", "    Blue", "", "  "} == out);
+
+        // Container is reused
+        auto capacity = out.capacity();
+        auto data     = out.data();
+        CHECK(fty::split("ex-parrot", "|", out).size() == 1);
+        CHECK(out.capacity() == capacity);
+        CHECK(out.data() == data);
+
+        CHECK(fty::split("", ";", out).empty());
+    }
+
+    SECTION("Vector, multi-character delimiter")
+    {
+        auto vec = fty::split("this::is::an::ex-parrot", "::");
+        CHECK(std::vector<std::string>{"this", "is", "an", "ex-parrot"} == vec);
+
+        auto vec2 = fty::split("a, b,, c,", ", ", fty::SplitOption::KeepEmpty | fty::SplitOption::NoTrim);
+        CHECK(std::vector<std::string>{"a", "b,", "c,"} == vec2);
+
+        auto vec3 = fty::split("a<=>b<=><=>c", "<=>", fty::SplitOption::KeepEmpty);
+        CHECK(std::vector<std::string>{"a", "b", "", "c"} == vec3);
+
+        // Long line, delimiter crosses vector blocks
+        std::string line;
+        for (int i = 0; i < 100; ++i) {
+            line += fmt::format("field{}-->", i);
+        }
+        auto vec4 = fty::split(line, "-->");
+        REQUIRE(vec4.size() == 100);
+        CHECK(vec4[99] == "field99");
+
+        CHECK(std::vector<std::string>{"no delimiter"} == fty::split("no delimiter", "::"));
+        CHECK(std::vector<std::string>{"empty delimiter"} == fty::split("empty delimiter", ""));
+    }
+
+    SECTION("Vector, delimiter set")
+    {
+        auto vec = fty::splitAnyOf("It's dead,\tthat's  what's,wrong", " \t,");
+        CHECK(std::vector<std::string>{"It's", "dead", "that's", "what's", "wrong"} == vec);
+
+        std::vector<std::string_view> out;
+        fty::splitAnyOf("a;b|c;;d", ";|", out, fty::SplitOption::KeepEmpty);
+        CHECK(std::vector<std::string_view>{"a", "b", "c", "", "d"} == out);
+
+        std::vector<std::string_view> fields;
+        for (auto field : fty::splitViewAnyOf("key = value; other", "=;")) {
+            fields.push_back(field);
+        }
+        CHECK(std::vector<std::string_view>{"key", "value", "other"} == fields);
+    }
+
+    SECTION("Lazy range")
+    {
+        std::vector<std::string_view> fields;
+        for (auto field : fty::splitView("this|| is |an|ex-parrot|", "|")) {
+            fields.push_back(field);
+        }
+        CHECK(std::vector<std::string_view>{"this", "is", "an", "ex-parrot"} == fields);
+
+        fields.clear();
+        for (auto field : fty::splitView("a||b", "|", fty::SplitOption::KeepEmpty)) {
+            fields.push_back(field);
+        }
+        CHECK(std::vector<std::string_view>{"a", "", "b"} == fields);
+
+        // Stops early, the rest of the string is not scanned
+        auto range = fty::splitView("name;value;and;much;more", ";");
+        auto it    = range.begin();
+        CHECK(*it == "name");
+        CHECK(*++it == "value");
+        CHECK(it->size() == 5);
+
+        // Same fields as split()
+        std::string str = " a ,, b,c , ";
+        auto        vec = fty::split(str, ",");
+        CHECK(std::equal(vec.begin(), vec.end(), fty::splitView(str, ",").begin(), fty::splitView(str, ",").end()));
+        CHECK(std::distance(fty::splitView(str, ",").begin(), fty::splitView(str, ",").end()) == long(vec.size()));
+
+        CHECK(fty::splitView("", ";").empty());
+        CHECK(fty::splitView(";;", ";").empty());
+        CHECK(!fty::splitView(";;", ";", fty::SplitOption::KeepEmpty).empty());
+    }
+
+    SECTION("Trimmed view")
+    {
+        CHECK(fty::trimmedView("  \tex-parrot \r\n") == "ex-parrot");
+        CHECK(fty::trimmedView("ex-parrot") == "ex-parrot");
+        CHECK(fty::trimmedView(" \t ").empty());
+        CHECK(fty::trimmedView("").empty());
+    }
+
     SECTION("Vector, split regex")
     {
         try {
@@ -113,3 +218,70 @@ TEST_CASE("Strange split")
         FAIL(e.what());
     }
 }
+
+TEST_CASE("Split pattern")
+{
+    SECTION("Same fields as std::regex")
+    {
+        std::vector<std::string> patterns = {",", ",+", "::", "\\s+", "\\s", "[,;]", "[,;]+", "[ \\t,]+", "[a-c]+", "\\|",
+            "\\.", "\\t", "[-/]", "x", ",\\s*"};
+        std::vector<std::string> strings  = {"", ",", ",,", "a,b", ",a,,b,", "  a  b\tc \n", "::a::::b:", "a;b,;c;,",
+            "abcxcba", "1.2.3", "x|y||z", "2020-01/02", "a\tb\t\tc", "a, b,c ,d"};
+        std::vector<fty::SplitOption> options = {fty::SplitOption::SkipEmpty | fty::SplitOption::Trim,
+            fty::SplitOption::KeepEmpty | fty::SplitOption::NoTrim, fty::SplitOption::KeepEmpty | fty::SplitOption::Trim};
+
+        for (const auto& pattern : patterns) {
+            fty::SplitPattern compiled(pattern);
+            std::regex        re(pattern);
+            CAPTURE(pattern);
+            CHECK((compiled.isSimple() || pattern == ",\\s*"));
+
+            for (const auto& str : strings) {
+                for (auto opt : options) {
+                    CAPTURE(str, int(opt));
+                    CHECK(fty::split(str, re, opt) == fty::split(str, compiled, opt));
+                }
+            }
+        }
+    }
+
+    SECTION("Not simple")
+    {
+        for (std::string pattern : {"a+b", "ab+", "[^,]", "(,)", "\\d+", ",|;", "[a-c]x", ".", ""}) {
+            CAPTURE(pattern);
+            CHECK(!fty::SplitPattern(pattern).isSimple());
+        }
+        CHECK(!fty::SplitPattern(",", std::regex::icase).isSimple());
+
+        // Groups are still taken as fields
+        auto [key, value] = fty::splitRegex<std::string, std::string>("key = \"value\"", "([a-z]+)\\s*=\\s*\"([^\"]+)\"");
+        CHECK("key" == key);
+        CHECK("value" == value);
+    }
+
+    SECTION("Cache")
+    {
+        auto first = fty::SplitPattern::cached("[,;]+");
+        CHECK(first == fty::SplitPattern::cached("[,;]+"));
+        CHECK(first != fty::SplitPattern::cached("[,;]+", std::regex::ECMAScript | std::regex::icase));
+        CHECK_THROWS_AS(fty::SplitPattern::cached("(unbalanced"), std::regex_error);
+
+        std::vector<std::thread> threads;
+        std::atomic<int>         errors{0};
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([&, i]() {
+                for (int j = 0; j < 100; ++j) {
+                    auto fields = fty::splitRegex(fmt::format("a{0}b{0}c", j % 2 ? "," : ";;"), "[,;]+");
+                    if (fields != std::vector<std::string>{"a", "b", "c"} || !fty::SplitPattern::cached("\\s+")->isSimple()) {
+                        ++errors;
+                    }
+                    fty::SplitPattern::cached(fmt::format("x{}", i * 100 + j));
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        CHECK(errors == 0);
+    }
+}
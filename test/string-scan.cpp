@@ -0,0 +1,77 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+#include "fty/string-scan.h"
+#include <catch2/catch.hpp>
+#include <random>
+#include <string>
+#include <string_view>
+
+using fty::detail::ScanLevel;
+
+TEST_CASE("String scan")
+{
+    // Every kernel against std::string_view, at every length and alignment around the vector widths
+    std::mt19937 random(42);
+    std::string  alphabet = "ab,;| \t\n\r";
+    std::string  buffer(200, ' ');
+    for (auto& ch : buffer) {
+        ch = alphabet[random() % alphabet.size()];
+    }
+
+    std::string_view spaces = " \t\n\r";
+
+    for (auto level : {ScanLevel::Scalar, ScanLevel::Sse2, ScanLevel::Avx2}) {
+        const auto& kernels = fty::detail::scanKernels(level);
+        CAPTURE(int(level));
+
+        for (size_t offset = 0; offset < 33; ++offset) {
+            for (size_t size = 0; offset + size <= buffer.size(); ++size) {
+                std::string_view str(buffer.data() + offset, size);
+
+                auto expected = [&](size_t pos) {
+                    return pos == std::string_view::npos ? size : pos;
+                };
+
+                REQUIRE(kernels.findChar(str.data(), size, ',') == expected(str.find(',')));
+                REQUIRE(kernels.findAnyOf(str.data(), size, ";|", 2) == expected(str.find_first_of(";|")));
+                REQUIRE(kernels.findAnyOf(str.data(), size, "|", 1) == expected(str.find('|')));
+                REQUIRE(kernels.findAnyOf(str.data(), size, "abcdefghijk;", 12) == expected(str.find_first_of("abcdefghijk;")));
+                REQUIRE(kernels.findString(str.data(), size, ", ", 2) == expected(str.find(", ")));
+                REQUIRE(kernels.findString(str.data(), size, "a\tb", 3) == expected(str.find("a\tb")));
+                REQUIRE(kernels.findString(str.data(), size, ";", 1) == expected(str.find(';')));
+                REQUIRE(kernels.skipSpace(str.data(), size) == expected(str.find_first_not_of(spaces)));
+
+                auto last = str.find_last_not_of(spaces);
+                REQUIRE(kernels.skipSpaceBack(str.data(), size) == (last == std::string_view::npos ? 0 : last + 1));
+            }
+        }
+    }
+
+    SECTION("Long runs")
+    {
+        std::string str(1000, ' ');
+        str[777] = 'x';
+        for (auto level : {ScanLevel::Scalar, ScanLevel::Sse2, ScanLevel::Avx2}) {
+            const auto& kernels = fty::detail::scanKernels(level);
+            CHECK(kernels.skipSpace(str.data(), str.size()) == 777);
+            CHECK(kernels.skipSpaceBack(str.data(), str.size()) == 778);
+            CHECK(kernels.findChar(str.data(), str.size(), 'x') == 777);
+            CHECK(kernels.findAnyOf(str.data(), str.size(), "yx", 2) == 777);
+            CHECK(kernels.findString(str.data(), str.size(), " x ", 3) == 776);
+            CHECK(kernels.findString(str.data(), str.size(), " xx", 3) == str.size());
+        }
+    }
+}